@@ -30,13 +30,13 @@
 	static t *array_push_##suf(struct array_##suf *self)			\
 	{									\
 		if (self->nelts >= self->nalloc) {				\
-			size_t const nmem = sizeof(t) * self->nelts * 2;	\
-			t *new = realloc(self->elts, nmem);			\
+			size_t const n = self->nalloc ? self->nalloc * 2 : 8;	\
+			t *new = realloc(self->elts, sizeof(t) * n);		\
 			if (new == NULL)					\
 				return NULL;					\
 										\
 			self->elts = new;					\
-			self->nalloc = self->nelts * 1.5;			\
+			self->nalloc = n;					\
 		}								\
 										\
 		return &self->elts[self->nelts++];				\
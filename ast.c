@@ -19,6 +19,7 @@ static const char *const ast_type_to_string[] = {
 	[ast_het] = "het",
 	[ast_print] = "print",
 	[ast_assign] = "=",
+	[ast_repeat] = "herhaal",
 	[ast_program] = "program"
 };
 
@@ -51,7 +52,7 @@ struct ast *ast_create_name(char *name_value)
 	return ast;
 }
 
-struct ast *ast_create_number(double number_value)
+struct ast *ast_create_number(struct value number_value)
 {
 	struct ast *ast = malloc(sizeof(struct ast));
 	if (ast == NULL)
@@ -68,6 +69,9 @@ struct ast *ast_create_number(double number_value)
 
 void ast_destroy(struct ast *a)
 {
+	if (a == NULL)
+		return;
+
 	for (size_t i = 0; i < a->children.nelts; i++)
 		ast_destroy(a->children.elts[i]);
 
@@ -79,48 +83,91 @@ void ast_destroy(struct ast *a)
 	free(a);
 }
 
-static char *ast_single_to_string(struct ast *a)
+void ast_add_child(struct ast *a, struct ast *child)
 {
-	char *s;
+	*array_push_ast_p(&a->children) = child;
+}
 
-	if (a->type == ast_number)
-		asprintf(&s, "%.5f", a->number_value);
-	else if (a->type == ast_name)
-		asprintf(&s, "\"%s\"", a->name_value);
+struct ast *ast_copy(struct ast *a)
+{
+	struct ast *copy;
+
+	if (a->type == ast_name)
+		copy = ast_create_name(strdup(a->name_value));
+	else if (a->type == ast_number)
+		copy = ast_create_number(a->number_value);
 	else
-		asprintf(&s, "%s", ast_type_to_string[a->type]);
+		copy = ast_create(a->type);
 
-	return s;
+	copy->span = a->span;
+	for (size_t i = 0; i < a->children.nelts; i++)
+		ast_add_child(copy, ast_copy(a->children.elts[i]));
+
+	return copy;
 }
 
-void ast_add_child(struct ast *a, struct ast *child)
+bool ast_equal(struct ast *a, struct ast *b)
 {
-	*array_push_ast_p(&a->children) = child;
+	if (a->type != b->type || a->children.nelts != b->children.nelts)
+		return false;
+
+	if (a->type == ast_name && strcmp(a->name_value, b->name_value) != 0)
+		return false;
+	if (a->type == ast_number && !value_equal(a->number_value, b->number_value))
+		return false;
+
+	for (size_t i = 0; i < a->children.nelts; i++) {
+		if (!ast_equal(a->children.elts[i], b->children.elts[i]))
+			return false;
+	}
+
+	return true;
 }
 
-char *ast_to_string(struct ast *a)
+bool ast_mentions(struct ast *a, char const *name)
 {
-	char *single = ast_single_to_string(a);
-	if (a->children.nelts == 0)
-		return single;
+	if (a->type == ast_name)
+		return strcmp(a->name_value, name) == 0;
 
-	char *children_str = strdup("");
 	for (size_t i = 0; i < a->children.nelts; i++) {
-		char *old = children_str;
-		char *new = ast_to_string(a->children.elts[i]);
+		if (ast_mentions(a->children.elts[i], name))
+			return true;
+	}
 
-		if (i == a->children.nelts - 1)
-			asprintf(&children_str, "%s%s", children_str, new);
-		else
-			asprintf(&children_str, "%s%s, ", children_str, new);
+	return false;
+}
 
-		free(old);
-		free(new);
+static void ast_write(struct ast *a, FILE *f)
+{
+	if (a->type == ast_number)
+		fprintf(f, "%.5f", value_to_double(a->number_value));
+	else if (a->type == ast_name)
+		fprintf(f, "\"%s\"", a->name_value);
+	else
+		fputs(ast_type_to_string[a->type], f);
+
+	if (a->children.nelts == 0)
+		return;
+
+	fputs(" (", f);
+	for (size_t i = 0; i < a->children.nelts; i++) {
+		if (i > 0)
+			fputs(", ", f);
+		ast_write(a->children.elts[i], f);
 	}
+	fputc(')', f);
+}
 
+/* One stream for the whole tree, so it takes time linear in its size. */
+char *ast_to_string(struct ast *a)
+{
 	char *s;
-	asprintf(&s, "%s (%s)", single, children_str);
-	free(single);
-	free(children_str);
+	size_t len;
+	FILE *f = open_memstream(&s, &len);
+	if (f == NULL)
+		return NULL;
+
+	ast_write(a, f);
+	fclose(f);
 	return s;
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "array.h"
+#include "token.h"
+#include <stdbool.h>
 
 array_declare(struct ast *, ast_p)
 
@@ -14,21 +16,27 @@ enum ast_type {
 	ast_het,
 	ast_print,
 	ast_assign,
+	ast_repeat,
 	ast_program
 };
 
 struct ast {
 	enum ast_type type;
+	struct span span;
 	struct array_ast_p children;
 	union {
-		double number_value;
+		struct value number_value;
 		char *name_value;
 	};
 };
 
 struct ast *ast_create(enum ast_type type);
 struct ast *ast_create_name(char *name_value);
-struct ast *ast_create_number(double number_value);
+struct ast *ast_create_number(struct value number_value);
+/* Like free, does nothing with NULL. */
 void ast_destroy(struct ast *a);
 void ast_add_child(struct ast *a, struct ast *child);
+struct ast *ast_copy(struct ast *a);
+bool ast_equal(struct ast *a, struct ast *b);
+bool ast_mentions(struct ast *a, char const *name);
 char *ast_to_string(struct ast *a);
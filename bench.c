@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+
+#include "interpreter.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "schedule.h"
+#include "snapshot.h"
+#include "stream.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *generate(size_t nstatements)
+{
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+
+	for (size_t i = 0; i < nstatements; i++) {
+		if (i % 4 == 3)
+			fprintf(f, "print waarde%c * (het + %zu) uit;\n", 'a' + (int)(i % 26), i);
+		else
+			fprintf(f, "laat waarde%c %zu + som / 3 - het zijn;\n", 'a' + (int)(i % 26), i);
+	}
+
+	fclose(f);
+	return buf;
+}
+
+/* Integer arithmetic, or the same arithmetic on reals if the seeds are reals. */
+static char *generate_arithmetic(size_t nstatements, char const *a, char const *b)
+{
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+
+	fprintf(f, "laat a %s zijn; laat b %s zijn;\n", a, b);
+	for (size_t i = 0; i < nstatements; i++) {
+		if (i % 3 == 2)
+			fprintf(f, "print a * 2 - b + het uit;\n");
+		else if (i % 3 == 1)
+			fprintf(f, "laat b a * %zu - b zijn;\n", i % 7);
+		else
+			fprintf(f, "laat a %zu - a zijn;\n", i);
+	}
+
+	fclose(f);
+	return buf;
+}
+
+static void report(char const *what, double seconds, size_t bytes)
+{
+	printf("%-24s %8.2f ms %8.1f MB/s\n", what, seconds * 1e3, bytes / seconds / 1e6);
+}
+
+static void bench_frontend(char *input)
+{
+	size_t bytes = strlen(input);
+	double t;
+
+	t = now();
+	struct lexer l = lexer_create(input);
+	size_t ntokens = 0;
+	while (lexer_next_token(&l).type != token_end)
+		ntokens++;
+	report("lexer", now() - t, bytes);
+
+	t = now();
+	struct stream s = stream_create(input);
+	report("stream_create", now() - t, bytes);
+
+	t = now();
+	struct parser p = parser_create(input);
+	struct parser_result res = parser_parse(&p);
+	report("parse (lexer)", now() - t, bytes);
+	ast_destroy(res.ast);
+	parser_destroy(&p);
+
+	t = now();
+	p = parser_create_stream(&s);
+	res = parser_parse(&p);
+	report("parse (stream)", now() - t, bytes);
+	ast_destroy(res.ast);
+	parser_destroy(&p);
+
+	t = now();
+	struct array_diagnostic diagnostics = { 0 };
+	res = parallel_parse(input, 0, &diagnostics);
+	report("parse (parallel)", now() - t, bytes);
+	ast_destroy(res.ast);
+	free(diagnostics.elts);
+
+	printf("%zu tokens, %zu bytes\n", ntokens, bytes);
+	stream_destroy(&s);
+}
+
+static void bench_interpreter(char const *what, char *input)
+{
+	struct parser p = parser_create(input);
+	struct parser_result res = parser_parse(&p);
+	FILE *null = fopen("/dev/null", "w");
+
+	double t = now();
+	struct interpreter i = interpreter_create(null);
+	interpreter_interpret(&i, res.ast);
+	report(what, now() - t, strlen(input));
+
+	interpreter_destroy(&i);
+	fclose(null);
+	ast_destroy(res.ast);
+	parser_destroy(&p);
+}
+
+/* A loop written out statement by statement against the same loop as a repeat. */
+static void bench_repeat(size_t nstatements)
+{
+	static char const body[] = "laat a 5 - a zijn; laat b a * 3 - b zijn; "
+				   "print a * 2 - b + het uit;\n";
+	size_t rounds = nstatements / 3;
+	FILE *null = fopen("/dev/null", "w");
+	char *unrolled, *repeat;
+	size_t unrolled_len, repeat_len;
+
+	FILE *f = open_memstream(&unrolled, &unrolled_len);
+	fputs("laat a 1 zijn; laat b 2 zijn;\n", f);
+	for (size_t i = 0; i < rounds; i++)
+		fputs(body, f);
+	fclose(f);
+
+	f = open_memstream(&repeat, &repeat_len);
+	fprintf(f, "laat a 1 zijn; laat b 2 zijn;\nherhaal %zu keer\n%sklaar;\n", rounds, body);
+	fclose(f);
+
+	char *inputs[] = { unrolled, repeat };
+	char const *names[] = { "unrolled (parse + run)", "herhaal (parse + run)" };
+	for (int k = 0; k < 2; k++) {
+		double t = now();
+		struct parser p = parser_create(inputs[k]);
+		struct parser_result res = parser_parse(&p);
+		struct interpreter i = interpreter_create(null);
+		interpreter_interpret(&i, res.ast);
+		report(names[k], now() - t, unrolled_len);
+
+		interpreter_destroy(&i);
+		ast_destroy(res.ast);
+		parser_destroy(&p);
+	}
+
+	printf("%zu bytes unrolled, %zu bytes with herhaal\n", unrolled_len, repeat_len);
+	fclose(null);
+	free(repeat);
+	free(unrolled);
+}
+
+/* One-shot lines as the interactive session reads them, through a tree and directly. */
+static void bench_lines(size_t nlines)
+{
+	char line[] = "laat a 5 - a zijn; laat b a * 3 - b zijn; print a * 2 - b + het uit;\n";
+	FILE *null = fopen("/dev/null", "w");
+	size_t bytes = nlines * strlen(line);
+	double t;
+
+	struct interpreter i = interpreter_create(null);
+	interpreter_set(&i, "a", value_create_integer(1));
+	interpreter_set(&i, "b", value_create_integer(2));
+
+	t = now();
+	for (size_t n = 0; n < nlines; n++) {
+		struct parser p = parser_create(line);
+		struct parser_result res = parser_parse(&p);
+		interpreter_interpret(&i, res.ast);
+		ast_destroy(res.ast);
+		parser_destroy(&p);
+	}
+	double tree = now() - t;
+	report("lines (tree)", tree, bytes);
+
+	t = now();
+	for (size_t n = 0; n < nlines; n++) {
+		struct parser p = parser_create_direct(line, &i);
+		parser_parse(&p);
+		parser_destroy(&p);
+	}
+	double direct = now() - t;
+	report("lines (direct)", direct, bytes);
+
+	printf("%.0f ns per line through a tree, %.0f ns directly\n",
+	       tree / nlines * 1e9, direct / nlines * 1e9);
+	interpreter_destroy(&i);
+	fclose(null);
+}
+
+/* Optimizing a script of distinct variables against running it. */
+static void bench_optimize(size_t nvariables)
+{
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+	for (size_t i = 0; i < nvariables; i++) {
+		fputs("laat v", f);
+		for (size_t n = i; n > 0; n /= 26)
+			fputc('a' + n % 26, f);
+		fprintf(f, " %zu zijn; print het + 1 uit;\n", i);
+	}
+	fclose(f);
+
+	struct parser p = parser_create(buf);
+	struct parser_result res = parser_parse(&p);
+	FILE *null = fopen("/dev/null", "w");
+
+	double t = now();
+	optimizer_optimize(res.ast);
+	report("optimize (many names)", now() - t, len);
+
+	t = now();
+	struct interpreter i = interpreter_create(null);
+	interpreter_interpret(&i, res.ast);
+	report("interpret (many names)", now() - t, len);
+
+	interpreter_destroy(&i);
+	fclose(null);
+	ast_destroy(res.ast);
+	parser_destroy(&p);
+	free(buf);
+}
+
+/* Scheduling a chain of "het" on threads against running it in order. */
+static void bench_schedule(size_t nstatements)
+{
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+	fputs("laat x 1 zijn;\n", f);
+	for (size_t i = 1; i < nstatements; i++)
+		fputs("laat het het + 1 zijn;\n", f);
+	fclose(f);
+
+	struct parser p = parser_create(buf);
+	struct parser_result res = parser_parse(&p);
+	FILE *null = fopen("/dev/null", "w");
+
+	double t = now();
+	struct interpreter i = interpreter_create(null);
+	interpreter_interpret(&i, res.ast);
+	report("interpret (het chain)", now() - t, len);
+	interpreter_destroy(&i);
+
+	t = now();
+	i = interpreter_create(null);
+	schedule_interpret(&i, res.ast, 4);
+	report("schedule (het chain)", now() - t, len);
+
+	interpreter_destroy(&i);
+	fclose(null);
+	ast_destroy(res.ast);
+	parser_destroy(&p);
+	free(buf);
+}
+
+/* Restoring a session from a snapshot against replaying the script that built it. */
+static void bench_snapshot(size_t nvariables)
+{
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+	for (size_t i = 0; i < nvariables; i++) {
+		fputs("laat v", f);
+		for (size_t n = i; n > 0; n /= 26)
+			fputc('a' + n % 26, f);
+		fprintf(f, " %zu * 3 zijn;\n", i);
+	}
+	fclose(f);
+
+	double t = now();
+	struct parser p = parser_create(buf);
+	struct parser_result res = parser_parse(&p);
+	struct interpreter i = interpreter_create(stdout);
+	interpreter_interpret(&i, res.ast);
+	report("replay", now() - t, len);
+	ast_destroy(res.ast);
+	parser_destroy(&p);
+
+	char path[] = "/tmp/cfeitsma-bench-XXXXXX";
+	close(mkstemp(path));
+
+	t = now();
+	snapshot_save(&i, path);
+	report("snapshot_save", now() - t, len);
+	interpreter_destroy(&i);
+
+	t = now();
+	i = interpreter_create(stdout);
+	snapshot_load(&i, path);
+	report("snapshot_load", now() - t, len);
+	printf("%zu variables\n", i.variables.nelts);
+
+	interpreter_destroy(&i);
+	remove(path);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	char *input = generate(n);
+
+	bench_frontend(input);
+	free(input);
+
+	input = generate_arithmetic(n, "1", "2");
+	bench_interpreter("interpret (integer)", input);
+	free(input);
+
+	input = generate_arithmetic(n, "1 / 1", "2 / 1");
+	bench_interpreter("interpret (real)", input);
+	free(input);
+
+	bench_repeat(n);
+
+	bench_lines(n);
+
+	bench_optimize(n);
+
+	bench_schedule(n);
+
+	bench_snapshot(n);
+}
@@ -0,0 +1,60 @@
+#define _GNU_SOURCE
+
+#include "budget.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static bool budget_set(struct budget *b, char const *key, size_t length, uint64_t n)
+{
+	if (length == 5 && !memcmp(key, "nodes", 5))
+		b->nodes = n;
+	else if (length == 5 && !memcmp(key, "depth", 5))
+		b->depth = n;
+	else if (length == 9 && !memcmp(key, "variables", 9))
+		b->variables = n;
+	else if (length == 10 && !memcmp(key, "statements", 10))
+		b->statements = n;
+	else if (length == 2 && !memcmp(key, "ms", 2))
+		b->milliseconds = n;
+	else
+		return false;
+
+	return true;
+}
+
+int budget_parse(struct budget *b, char const *spec)
+{
+	struct budget parsed = { 0 };
+
+	for (char const *p = spec; *p;) {
+		size_t length = strcspn(p, "=");
+		char const *digits = &p[length + 1];
+		if (p[length] != '=' || *digits < '0' || *digits > '9') {
+			errno = EINVAL;
+			return -1;
+		}
+
+		char *end;
+		errno = 0;
+		uint64_t n = strtoull(digits, &end, 10);
+		if (errno || (*end != ',' && *end != '\0') || !budget_set(&parsed, p, length, n)) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		p = *end ? end + 1 : end;
+	}
+
+	*b = parsed;
+	return 0;
+}
+
+uint64_t budget_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Limits on one evaluation, so that a huge or deeply nested input fails with
+ * a diagnostic instead of stalling a worker or overflowing the stack. A limit
+ * of 0 is no limit.
+ *
+ * Nodes and depth bound a parse: depth counts the parentheses and repeats
+ * around an expression and the operators chained in it. Statements and
+ * milliseconds bound a run, from interpreter_begin. Variables bound a
+ * session, and with them, in reactive mode, how deeply formulas can chain.
+ * Memory follows from nodes and variables, which each have a fixed size.
+ *
+ * A parser or interpreter checks a budget when one is set, like a profile.
+ */
+struct budget {
+	size_t nodes;
+	size_t depth;
+	size_t variables;
+	uint64_t statements;
+	uint64_t milliseconds;
+};
+
+/*
+ * Reads a comma separated list such as "nodes=100000,depth=200,ms=50", with
+ * the keys nodes, depth, variables, statements and ms. Returns 0 on success
+ * and -1 with errno set to EINVAL on failure.
+ */
+int budget_parse(struct budget *b, char const *spec);
+/* The monotonic clock in nanoseconds, which deadlines are kept in. */
+uint64_t budget_now(void);
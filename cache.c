@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "hash.h"
+#include "lexer.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Past this many statements the cache starts over instead of growing. */
+#define MAX_ENTRIES (1 << 16)
+
+/* A cached program, and where its statement starts in the line being run. */
+struct cache_statement {
+	struct ast *ast;
+	struct span at;
+};
+
+array_all_declare(struct cache_statement, statement)
+
+static void cache_clear(struct cache *self);
+static void cache_shift(struct diagnostic *d, struct span at);
+static void cache_insert(struct cache *self, struct cache_entry entry);
+
+struct cache cache_create(void)
+{
+	return (struct cache) {
+		.entries = calloc(64, sizeof(struct cache_entry)),
+		.size = 64,
+		.nentries = 0
+	};
+}
+
+void cache_destroy(struct cache *self)
+{
+	cache_clear(self);
+	free(self->entries);
+}
+
+struct parser_result cache_parse(struct cache *self, char *text, size_t length,
+				 struct budget const *budget)
+{
+	while (length > 0 && isspace(*text)) {
+		text++;
+		length--;
+	}
+	while (length > 0 && isspace(text[length - 1]))
+		length--;
+
+	uint64_t hash = hash_bytes(text, length);
+	size_t mask = self->size - 1;
+
+	for (size_t i = hash & mask; self->entries[i].text; i = (i + 1) & mask) {
+		struct cache_entry *e = &self->entries[i];
+		if (e->hash == hash && strncmp(e->text, text, length) == 0 &&
+		    e->text[length] == '\0')
+			return (struct parser_result) { .ast = e->ast };
+	}
+
+	char *copy = strndup(text, length);
+	struct parser parser = parser_create(copy);
+	parser.budget = budget;
+	struct parser_result res = parser_parse(&parser);
+
+	if (res.error) {
+		self->diagnostic = *res.error;
+		parser_destroy(&parser);
+		free(copy);
+		return (struct parser_result) { .error = &self->diagnostic };
+	}
+
+	parser_destroy(&parser);
+
+	cache_insert(self, (struct cache_entry) {
+		.hash = hash,
+		.text = copy,
+		.ast = res.ast
+	});
+
+	return res;
+}
+
+void cache_trim(struct cache *self)
+{
+	if (self->nentries >= MAX_ENTRIES)
+		cache_clear(self);
+}
+
+struct diagnostic const *cache_run(struct cache *self, struct interpreter *i, char *line)
+{
+	struct array_statement stmts = array_create_statement();
+	char *end = line + strlen(line);
+	struct span at = { .line = 1, .column = 1 };
+	int depth = 0;
+
+	cache_trim(self);
+
+	for (char *start = line;;) {
+		/* Skipped here rather than by cache_parse, to know where it starts. */
+		for (; start < end && isspace(*start); start++) {
+			at.line += *start == '\n';
+			at.column = *start == '\n' ? 1 : at.column + 1;
+		}
+		at.offset = start - line;
+
+		char *p = lexer_statement_end(start, end, &depth);
+		char *stop = p ? p + 1 : end;
+
+		struct parser_result res = cache_parse(self, start, stop - start, i->budget);
+		if (res.error) {
+			array_destroy_statement(stmts);
+			cache_shift(&self->diagnostic, at);
+			return res.error;
+		}
+
+		*array_push_statement(&stmts) = (struct cache_statement) { res.ast, at };
+
+		if (p == NULL)
+			break;
+		for (; start < stop; start++) {
+			at.line += *start == '\n';
+			at.column = *start == '\n' ? 1 : at.column + 1;
+		}
+	}
+
+	/* The budget is for the whole line, as it is without the cache. */
+	i->error = NULL;
+	interpreter_begin(i);
+	for (size_t n = 0; n < stmts.nelts && !i->error; n++) {
+		struct array_ast_p *children = &stmts.elts[n].ast->children;
+		for (size_t c = 0; c < children->nelts && !i->error; c++)
+			interpreter_statement(i, children->elts[c]);
+		if (i->error)
+			cache_shift(&i->diagnostic, stmts.elts[n].at);
+	}
+
+	array_destroy_statement(stmts);
+	return i->error;
+}
+
+/* Moves a span within a statement to where the statement starts in its line. */
+static void cache_shift(struct diagnostic *d, struct span at)
+{
+	if (d->span.line == 1)
+		d->span.column += at.column - 1;
+	d->span.line += at.line - 1;
+	d->span.offset += at.offset;
+}
+
+static void cache_clear(struct cache *self)
+{
+	for (size_t i = 0; i < self->size; i++) {
+		if (self->entries[i].text) {
+			free(self->entries[i].text);
+			ast_destroy(self->entries[i].ast);
+		}
+	}
+
+	memset(self->entries, 0, sizeof(struct cache_entry) * self->size);
+	self->nentries = 0;
+}
+
+static void cache_insert(struct cache *self, struct cache_entry entry)
+{
+	if ((self->nentries + 1) * 2 > self->size) {
+		struct cache_entry *old = self->entries;
+		size_t old_size = self->size;
+
+		self->size *= 2;
+		self->entries = calloc(self->size, sizeof(struct cache_entry));
+		self->nentries = 0;
+
+		for (size_t i = 0; i < old_size; i++) {
+			if (old[i].text)
+				cache_insert(self, old[i]);
+		}
+
+		free(old);
+	}
+
+	size_t mask = self->size - 1;
+	size_t i = entry.hash & mask;
+	while (self->entries[i].text)
+		i = (i + 1) & mask;
+
+	self->entries[i] = entry;
+	self->nentries++;
+}
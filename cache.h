@@ -0,0 +1,40 @@
+#pragma once
+
+#include "interpreter.h"
+#include "parser.h"
+#include <stdint.h>
+
+/*
+ * Remembers the parse of every statement seen in a session, keyed by its text,
+ * so that reentered statements are not lexed or parsed again. The cache owns
+ * the returned programs; each holds exactly one statement. A returned error
+ * stays valid until the next call. Statements are parsed within the budget,
+ * if any, which must stay the same for the life of the cache.
+ *
+ * cache_trim starts over once the cache is full. It frees every program the
+ * cache returned, so call it between lines, never while one is still held.
+ *
+ * cache_run does both for a whole line: it parses every statement through the
+ * cache, then runs them in order, with the interpreter's budget counting from
+ * the start of the line. It gives the syntax or runtime error, if any.
+ */
+
+struct cache_entry {
+	uint64_t hash;
+	char *text;
+	struct ast *ast;
+};
+
+struct cache {
+	struct cache_entry *entries;
+	size_t size;
+	size_t nentries;
+	struct diagnostic diagnostic;
+};
+
+struct cache cache_create(void);
+void cache_destroy(struct cache *c);
+struct parser_result cache_parse(struct cache *c, char *text, size_t length,
+				 struct budget const *budget);
+void cache_trim(struct cache *c);
+struct diagnostic const *cache_run(struct cache *c, struct interpreter *i, char *line);
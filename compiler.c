@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+
+#include "compiler.h"
+#include "ast.h"
+#include "diagnostic.h"
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+array_create_declare(char *, str)
+array_destroy_declare(char *, str)
+array_push_declare(char *, str)
+
+/*
+ * Values of last_var for when which variable "het" is depends on how often a
+ * repeat ran, and when it may not be any variable yet.
+ */
+#define LAST_UNKNOWN -2
+#define LAST_UNSET -3
+
+static bool compiler_statement(struct compiler *self, struct ast *ast);
+static bool compiler_assign(struct compiler *self, struct ast *ast);
+static bool compiler_print(struct compiler *self, struct ast *ast);
+static bool compiler_repeat(struct compiler *self, struct ast *ast);
+static void compiler_expression(struct compiler *self, struct ast *ast);
+static bool compiler_check(struct compiler *self, struct ast *ast);
+static void compiler_guard(struct compiler *self, char *condition, struct diagnostic d);
+static void compiler_error(struct compiler *self, struct diagnostic d);
+static void compiler_indent(struct compiler *self);
+static void compiler_hoist(struct compiler *self, struct ast **statements, size_t n);
+static void compiler_collect(struct compiler *self, struct ast *ast);
+static bool compiler_contains(struct ast *ast, enum ast_type type);
+static bool compiler_assigns(struct ast *ast);
+static int compiler_lookup(struct compiler *self, char const *name);
+
+/* The arithmetic of value.h, for the generated code. */
+static char const compiler_prelude[] =
+	"#include <inttypes.h>\n"
+	"#include <math.h>\n"
+	"#include <stdint.h>\n"
+	"#include <stdio.h>\n"
+	"\n"
+	"struct value { int real; int64_t i; double d; };\n"
+	"\n"
+	"static inline struct value I(int64_t i) { return (struct value) { 0, i, 0 }; }\n"
+	"static inline struct value D(double d) { return (struct value) { 1, 0, d }; }\n"
+	"static inline double dbl(struct value v) { return v.real ? v.d : (double)v.i; }\n"
+	"\n"
+	"#define ARITH(name, op, check) \\\n"
+	"static inline struct value name(struct value a, struct value b) \\\n"
+	"{ \\\n"
+	"\tint64_t n; \\\n"
+	"\tif (!a.real && !b.real && !check(a.i, b.i, &n)) \\\n"
+	"\t\treturn I(n); \\\n"
+	"\treturn D(dbl(a) op dbl(b)); \\\n"
+	"}\n"
+	"ARITH(add, +, __builtin_add_overflow)\n"
+	"ARITH(sub, -, __builtin_sub_overflow)\n"
+	"ARITH(mul, *, __builtin_mul_overflow)\n"
+	"\n"
+	"static inline struct value quo(struct value a, struct value b) { return D(dbl(a) / dbl(b)); }\n"
+	"\n"
+	"static inline int64_t times(struct value v)\n"
+	"{\n"
+	"\tif (!v.real)\n"
+	"\t\treturn v.i < 0 ? -1 : v.i;\n"
+	"\tif (v.d >= 0 && v.d < 0x1p63 && v.d == (double)(int64_t)v.d)\n"
+	"\t\treturn v.d;\n"
+	"\treturn -1;\n"
+	"}\n"
+	"\n"
+	"static inline void print(struct value v)\n"
+	"{\n"
+	"\tif (v.real)\n"
+	"\t\tprintf(\"%f\\n\", v.d);\n"
+	"\telse\n"
+	"\t\tprintf(\"%\" PRId64 \".000000\\n\", v.i);\n"
+	"}\n"
+	"\n";
+
+struct compiler compiler_create(FILE *output)
+{
+	return (struct compiler) {
+		.output = output,
+		.variables = array_create_str(),
+		.last_var = -1
+	};
+}
+
+void compiler_destroy(struct compiler *self)
+{
+	for (size_t i = 0; i < self->variables.nelts; i++)
+		free(self->variables.elts[i]);
+
+	array_destroy_str(self->variables);
+	free(self->certain);
+}
+
+void compiler_compile(struct compiler *self, struct ast *ast)
+{
+	fputs(compiler_prelude, self->output);
+	fputs("int main(void)\n"
+	      "{\n", self->output);
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < ast->children.nelts; i++) {
+		if (ast->children.elts[i]->type == ast_repeat && !self->dynamic)
+			compiler_hoist(self, &ast->children.elts[i], ast->children.nelts - i);
+		ok = compiler_statement(self, ast->children.elts[i]);
+	}
+
+	if (ok)
+		fputs("\treturn 0;\n", self->output);
+
+	fputs("}\n", self->output);
+}
+
+static bool compiler_statement(struct compiler *self, struct ast *ast)
+{
+	if (ast->type == ast_print)
+		return compiler_print(self, ast);
+	else if (ast->type == ast_assign)
+		return compiler_assign(self, ast);
+	else if (ast->type == ast_repeat)
+		return compiler_repeat(self, ast);
+	else
+		assert(false);
+}
+
+static bool compiler_print(struct compiler *self, struct ast *ast)
+{
+	if (!compiler_check(self, ast->children.elts[0]))
+		return false;
+
+	compiler_indent(self);
+	fputs("print(", self->output);
+	compiler_expression(self, ast->children.elts[0]);
+	fputs(");\n", self->output);
+	return true;
+}
+
+static bool compiler_assign(struct compiler *self, struct ast *ast)
+{
+	char *name;
+
+	if (ast->children.elts[0]->type == ast_name) {
+		name = ast->children.elts[0]->name_value;
+	} else if (ast->children.elts[0]->type == ast_het) {
+		/* The variable "het" is was set already, so only its value changes. */
+		if (!compiler_check(self, ast->children.elts[0]) ||
+		    !compiler_check(self, ast->children.elts[1]))
+			return false;
+
+		compiler_indent(self);
+		compiler_expression(self, ast->children.elts[0]);
+		fputs(" = ", self->output);
+		compiler_expression(self, ast->children.elts[1]);
+		fputs(";\n", self->output);
+		return true;
+	} else {
+		assert(false);
+	}
+
+	if (!compiler_check(self, ast->children.elts[1]))
+		return false;
+
+	int var = compiler_lookup(self, name);
+	compiler_indent(self);
+	if (var < 0) {
+		var = self->variables.nelts;
+		*array_push_str(&self->variables) = strdup(name);
+		fprintf(self->output, "struct value v_%s = ", name);
+	} else {
+		fprintf(self->output, "v_%s = ", name);
+	}
+
+	compiler_expression(self, ast->children.elts[1]);
+	fputs(";\n", self->output);
+
+	if (self->dynamic && !self->certain[var]) {
+		self->certain[var] = true;
+		compiler_indent(self);
+		fprintf(self->output, "d_%s = 1;\n", name);
+	}
+	if (self->tracking) {
+		compiler_indent(self);
+		fprintf(self->output, "last = %d;\n", var);
+	}
+
+	self->last_var = var;
+	return true;
+}
+
+/*
+ * Only the variables that were certainly set before the first round are so
+ * on every round, and after the last one. Which variable "het" is stays known
+ * only if the body never assigns to a name; assigning to "het" keeps it.
+ */
+static bool compiler_repeat(struct compiler *self, struct ast *ast)
+{
+	if (!compiler_check(self, ast->children.elts[0]))
+		return false;
+
+	int r = ++self->nrepeats;
+	compiler_indent(self);
+	fprintf(self->output, "struct value c%d = ", r);
+	compiler_expression(self, ast->children.elts[0]);
+	fputs(";\n", self->output);
+
+	/* Formatted as diagnostic_invalid_count is. */
+	compiler_indent(self);
+	fprintf(self->output, "if (times(c%d) < 0) {\n", r);
+	self->depth++;
+	compiler_indent(self);
+	fprintf(self->output, "printf(\"can't repeat %%f times\\n\", dbl(c%d));\n", r);
+	compiler_indent(self);
+	fputs("return 1;\n", self->output);
+	self->depth--;
+	compiler_indent(self);
+	fputs("}\n", self->output);
+
+	compiler_indent(self);
+	fprintf(self->output, "for (int64_t n%d = times(c%d); n%d > 0; n%d--) {\n", r, r, r, r);
+
+	struct ast *body = ast->children.elts[1];
+	size_t nvariables = self->variables.nelts;
+	bool *certain = malloc(nvariables ? nvariables : 1);
+	memcpy(certain, self->certain, nvariables);
+
+	if (compiler_assigns(body))
+		self->last_var = self->last_var == -1 || self->last_var == LAST_UNSET
+				 ? LAST_UNSET : LAST_UNKNOWN;
+	int last_var = self->last_var;
+
+	/* A statement that fails leaves the rest of the body unreachable. */
+	self->depth++;
+	for (size_t i = 0; i < body->children.nelts; i++) {
+		if (!compiler_statement(self, body->children.elts[i]))
+			break;
+	}
+	self->depth--;
+
+	compiler_indent(self);
+	fputs("}\n", self->output);
+
+	memcpy(self->certain, certain, nvariables);
+	free(certain);
+	self->last_var = last_var;
+	return true;
+}
+
+static void compiler_expression(struct compiler *self, struct ast *ast)
+{
+	switch (ast->type) {
+	case ast_name:
+		fprintf(self->output, "v_%s", ast->name_value);
+		return;
+	case ast_number:
+		if (ast->number_value.type == value_integer)
+			fprintf(self->output, "I(INT64_C(%" PRId64 "))", ast->number_value.integer);
+		else if (isinf(ast->number_value.real))
+			fputs("D(HUGE_VAL)", self->output);
+		else
+			fprintf(self->output, "D(%a)", ast->number_value.real);
+		return;
+	case ast_het:
+		if (self->last_var < 0)
+			fputs("(*vars[last])", self->output);
+		else
+			fprintf(self->output, "v_%s", self->variables.elts[self->last_var]);
+		return;
+	default:
+		break;
+	}
+
+	char const *fn;
+	switch (ast->type) {
+	case ast_plus: fn = "add"; break;
+	case ast_minus: fn = "sub"; break;
+	case ast_star: fn = "mul"; break;
+	case ast_slash: fn = "quo"; break;
+	default: assert(false);
+	}
+
+	fprintf(self->output, "%s(", fn);
+	compiler_expression(self, ast->children.elts[0]);
+	fputs(", ", self->output);
+	compiler_expression(self, ast->children.elts[1]);
+	fputc(')', self->output);
+}
+
+/*
+ * Finds the first name the interpreter would fail on, in the same left to
+ * right order, and emits code that reports it instead of the expression.
+ */
+static bool compiler_check(struct compiler *self, struct ast *ast)
+{
+	switch (ast->type) {
+	case ast_number:
+		return true;
+	case ast_het:
+		if (self->last_var == LAST_UNSET)
+			compiler_guard(self, strdup("last < 0"),
+				       diagnostic_create(diagnostic_invalid_het, ast->span));
+		if (self->last_var != -1)
+			return true;
+		compiler_error(self, diagnostic_create(diagnostic_invalid_het, ast->span));
+		return false;
+	case ast_name: {
+		int var = compiler_lookup(self, ast->name_value);
+		struct diagnostic d = diagnostic_create(diagnostic_undefined_variable,
+							ast->span);
+		diagnostic_set_text(&d, ast->name_value, strlen(ast->name_value));
+
+		if (var >= 0 && self->dynamic && !self->certain[var]) {
+			char *condition;
+			asprintf(&condition, "!d_%s", ast->name_value);
+			compiler_guard(self, condition, d);
+		}
+		if (var >= 0)
+			return true;
+
+		compiler_error(self, d);
+		return false;
+	}
+	default:
+		return compiler_check(self, ast->children.elts[0]) &&
+		       compiler_check(self, ast->children.elts[1]);
+	}
+}
+
+/* Emits code that reports d if condition, which is freed, holds at run time. */
+static void compiler_guard(struct compiler *self, char *condition, struct diagnostic d)
+{
+	compiler_indent(self);
+	fprintf(self->output, "if (%s) {\n", condition);
+	self->depth++;
+	compiler_error(self, d);
+	self->depth--;
+	compiler_indent(self);
+	fputs("}\n", self->output);
+	free(condition);
+}
+
+static void compiler_error(struct compiler *self, struct diagnostic d)
+{
+	char buf[512];
+	diagnostic_format(&d, buf, sizeof(buf));
+
+	compiler_indent(self);
+	fputs("puts(\"", self->output);
+	for (char *c = buf; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fputc('\\', self->output);
+		fputc(*c, self->output);
+	}
+	fputs("\");\n", self->output);
+	compiler_indent(self);
+	fputs("return 1;\n", self->output);
+}
+
+static void compiler_indent(struct compiler *self)
+{
+	for (int i = 0; i <= self->depth; i++)
+		fputc('\t', self->output);
+}
+
+/*
+ * From the first repeat on, whether a variable is set or which one "het" is
+ * can depend on how often a body ran. Every variable assigned from there is
+ * declared up front with a flag that says whether it is set. If "het" is used,
+ * the last variable assigned is kept at run time as well, as an index into
+ * vars.
+ */
+static void compiler_hoist(struct compiler *self, struct ast **statements, size_t n)
+{
+	size_t hoisted = self->variables.nelts;
+	bool het = false;
+
+	for (size_t i = 0; i < n; i++) {
+		compiler_collect(self, statements[i]);
+		het = het || compiler_contains(statements[i], ast_het);
+	}
+
+	self->dynamic = true;
+	self->certain = calloc(self->variables.nelts ? self->variables.nelts : 1, sizeof(bool));
+	for (size_t i = 0; i < hoisted; i++)
+		self->certain[i] = true;
+
+	if (!het || self->variables.nelts == 0)
+		return;
+
+	self->tracking = true;
+	fprintf(self->output, "\tint last = %d;\n", self->last_var);
+	fputs("\tstruct value *const vars[] = {", self->output);
+	for (size_t i = 0; i < self->variables.nelts; i++)
+		fprintf(self->output, "%s &v_%s", i ? "," : "", self->variables.elts[i]);
+	fputs(" };\n", self->output);
+}
+
+static void compiler_collect(struct compiler *self, struct ast *ast)
+{
+	if (ast->type == ast_assign && ast->children.elts[0]->type == ast_name) {
+		char *name = ast->children.elts[0]->name_value;
+		if (compiler_lookup(self, name) < 0) {
+			*array_push_str(&self->variables) = strdup(name);
+			fprintf(self->output, "\tstruct value v_%s = I(0);\n"
+				"\tint d_%s __attribute__((unused)) = 0;\n",
+				name, name);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < ast->children.nelts; i++)
+		compiler_collect(self, ast->children.elts[i]);
+}
+
+static bool compiler_contains(struct ast *ast, enum ast_type type)
+{
+	if (ast->type == type)
+		return true;
+
+	for (size_t i = 0; i < ast->children.nelts; i++) {
+		if (compiler_contains(ast->children.elts[i], type))
+			return true;
+	}
+
+	return false;
+}
+
+static bool compiler_assigns(struct ast *ast)
+{
+	if (ast->type == ast_assign)
+		return ast->children.elts[0]->type == ast_name;
+
+	for (size_t i = 0; i < ast->children.nelts; i++) {
+		if (compiler_assigns(ast->children.elts[i]))
+			return true;
+	}
+
+	return false;
+}
+
+static int compiler_lookup(struct compiler *self, char const *name)
+{
+	for (size_t i = 0; i < self->variables.nelts; i++) {
+		if (strcmp(self->variables.elts[i], name) == 0)
+			return i;
+	}
+
+	return -1;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "array.h"
+#include "ast.h"
+#include <stdio.h>
+
+/*
+ * Translates a program into a standalone C translation unit. Variables become
+ * locals and "het" is resolved while compiling, so the result only needs libc
+ * and a compiler with the GCC overflow builtins. A repeat becomes a loop;
+ * what cannot be known before it runs is checked at run time instead.
+ * Build it with -ffp-contract=off to get the same output as the interpreter.
+ */
+
+array_declare(char *, str)
+
+struct compiler {
+	FILE *output;
+	struct array_str variables;
+	int last_var;
+	int depth;
+	int nrepeats;
+	/* Whether each variable is known to be set, once a repeat is reached. */
+	bool dynamic;
+	bool *certain;
+	bool tracking;
+};
+
+struct compiler compiler_create(FILE *output);
+void compiler_destroy(struct compiler *c);
+void compiler_compile(struct compiler *c, struct ast *ast);
@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+
+#include "diagnostic.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct diagnostic diagnostic_create(enum diagnostic_code code, struct span span)
+{
+	return (struct diagnostic) {
+		.code = code,
+		.span = span
+	};
+}
+
+void diagnostic_set_text(struct diagnostic *d, char const *text, size_t length)
+{
+	if (length > MAX_NAME_LENGTH)
+		length = MAX_NAME_LENGTH;
+
+	memcpy(d->text, text, length);
+	d->text[length] = '\0';
+}
+
+int diagnostic_format(struct diagnostic const *d, char *buf, size_t size)
+{
+	switch (d->code) {
+	case diagnostic_none:
+		return snprintf(buf, size, "no error");
+	case diagnostic_invalid_character:
+		return snprintf(buf, size, "Invalid character: '%c'", d->text[0]);
+	case diagnostic_name_too_long:
+		return snprintf(buf, size, "Name starting with \"%.10s\" is too long!",
+				d->text);
+	case diagnostic_unexpected_token:
+		if (d->got.type == token_name)
+			return snprintf(buf, size, "Want %s, got <\"%s\">.", d->want,
+					d->text);
+		else if (d->got.type == token_number)
+			return snprintf(buf, size, "Want %s, got <%.5f>.", d->want,
+					value_to_double(d->got.number_value));
+		else
+			return snprintf(buf, size, "Want %s, got <%s>.", d->want,
+					token_type_to_string(d->got.type));
+	case diagnostic_undefined_variable:
+		return snprintf(buf, size, "variable named \"%s\" doesn't exist",
+				d->text);
+	case diagnostic_invalid_het:
+		return snprintf(buf, size, "\"het\" is invalid here");
+	case diagnostic_invalid_count:
+		return snprintf(buf, size, "can't repeat %f times",
+				value_to_double(d->got.number_value));
+	case diagnostic_too_many_nodes:
+		return snprintf(buf, size, "program is larger than %" PRId64 " nodes",
+				d->got.number_value.integer);
+	case diagnostic_too_deep:
+		return snprintf(buf, size, "nested deeper than %" PRId64,
+				d->got.number_value.integer);
+	case diagnostic_too_many_variables:
+		return snprintf(buf, size, "more than %" PRId64 " variables",
+				d->got.number_value.integer);
+	case diagnostic_too_many_statements:
+		return snprintf(buf, size, "ran more than %" PRId64 " statements",
+				d->got.number_value.integer);
+	case diagnostic_too_slow:
+		return snprintf(buf, size, "ran longer than %" PRId64 " ms",
+				d->got.number_value.integer);
+	default:
+		assert(false);
+	}
+}
+
+char *diagnostic_to_string(struct diagnostic const *d)
+{
+	int n = diagnostic_format(d, NULL, 0);
+	char *s = malloc(n + 1);
+	if (s == NULL)
+		return NULL;
+
+	diagnostic_format(d, s, n + 1);
+	return s;
+}
+
+void diagnostic_print(struct diagnostic const *d, FILE *f)
+{
+	char buf[512];
+
+	diagnostic_format(d, buf, sizeof(buf));
+	fputs(buf, f);
+	fputc('\n', f);
+}
+
+void diagnostic_print_at(struct diagnostic const *d, char const *file, FILE *f)
+{
+	fprintf(f, "%s:%d:%d: ", file, d->span.line, d->span.column);
+	diagnostic_print(d, f);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "token.h"
+#include <stddef.h>
+#include <stdio.h>
+
+enum diagnostic_code {
+	diagnostic_none,
+	diagnostic_invalid_character,
+	diagnostic_name_too_long,
+	diagnostic_unexpected_token,
+	diagnostic_undefined_variable,
+	diagnostic_invalid_het,
+	diagnostic_invalid_count,
+	diagnostic_too_many_nodes,
+	diagnostic_too_deep,
+	diagnostic_too_many_variables,
+	diagnostic_too_many_statements,
+	diagnostic_too_slow
+};
+
+/*
+ * Everything needed to describe an error, kept in a fixed-size struct so that
+ * reporting one never allocates. The message is only put together when it is
+ * formatted or printed.
+ */
+struct diagnostic {
+	enum diagnostic_code code;
+	struct span span;
+	char const *want;
+	struct token got;
+	char text[MAX_NAME_LENGTH + 1];
+};
+
+/* A budget error keeps the limit it exceeded in got. */
+struct diagnostic diagnostic_create(enum diagnostic_code code, struct span span);
+void diagnostic_set_text(struct diagnostic *d, char const *text, size_t length);
+int diagnostic_format(struct diagnostic const *d, char *buf, size_t size);
+char *diagnostic_to_string(struct diagnostic const *d);
+void diagnostic_print(struct diagnostic const *d, FILE *f);
+void diagnostic_print_at(struct diagnostic const *d, char const *file, FILE *f);
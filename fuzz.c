@@ -0,0 +1,458 @@
+#define _GNU_SOURCE
+
+#include "compiler.h"
+#include "interpreter.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "parser.h"
+#include "profile.h"
+#include "schedule.h"
+#include "stream.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Differential fuzzing harness. Every input is parsed by the lexer, from a
+ * stream and on several threads, which must give the same program or the
+ * same diagnostics. A program that parses is then run plainly, optimized,
+ * scheduled, profiled and by direct evaluation, which must all print the
+ * same. Reactive mode differs by design and is only run for crashes. C output
+ * is always generated, but only compiled and run when $FUZZ_CC names a C
+ * compiler, since that costs far more than the rest; it must print the same
+ * as well. A disagreement aborts, which libFuzzer and AFL report as a crash.
+ *
+ * The time and allocations of each input are measured, and the inputs that
+ * cost the most per byte are kept in $FUZZ_SLOW (or slow/), so that a blowup
+ * the fuzzer runs into can be replayed as a regression test. Compiling C code
+ * is not counted, since that is mostly the cost of the compiler.
+ *
+ * Inputs are cut into chunks and programs are run on threads at sizes far
+ * below what pays off, so that fuzz inputs take those paths as well.
+ *
+ * Every later stage recurses over the tree, so an input is first parsed within
+ * the limits below; one that exceeds them is checked no further. Repeat counts
+ * are not bounded, so give the fuzzer a timeout as well.
+ *
+ * With -DLIBFUZZER and -fsanitize=fuzzer (make fuzz-libfuzzer) this is a
+ * libFuzzer target. Otherwise (make fuzz) it runs each file named on the
+ * command line, or stdin, which is what AFL expects, and reports each one.
+ */
+
+#define THREADS 3
+#define KEEP 16
+/* Below this, the fixed cost of starting threads outweighs the input. */
+#define MIN_SLOW_SIZE 256
+
+static struct budget const limits = { .nodes = 1 << 16, .depth = 256 };
+
+/*
+ * Counts every allocation, including those made inside libc, unless a
+ * sanitizer replaces malloc itself, as it does in a libFuzzer build.
+ */
+#if !defined(LIBFUZZER) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCATIONS
+#endif
+
+#ifdef COUNT_ALLOCATIONS
+static atomic_size_t allocations;
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	allocations++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	allocations++;
+	return __libc_realloc(p, size);
+}
+#endif
+
+enum path {
+	path_plain,
+	path_optimized,
+	path_scheduled,
+	path_profiled,
+	path_reactive
+};
+
+struct slow {
+	double cost;
+	char *path;
+};
+
+static struct slow slowest[KEEP];
+static char const *slow_dir;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Frees got. A mismatch is a finding, so it aborts with both outputs. */
+static void fuzz_same(char const *path, char const *want, char *got)
+{
+	if (strcmp(want, got) != 0) {
+		fprintf(stderr, "%s differs\n--- want\n%s\n--- got\n%s\n", path, want, got);
+		abort();
+	}
+
+	free(got);
+}
+
+/* The program, or else every diagnostic with its location. */
+static char *fuzz_parsed(struct parser_result res, struct array_diagnostic const *diagnostics)
+{
+	if (res.ast)
+		return ast_to_string(res.ast);
+
+	char *s;
+	size_t len;
+	FILE *f = open_memstream(&s, &len);
+	for (size_t n = 0; n < diagnostics->nelts; n++)
+		diagnostic_print_at(&diagnostics->elts[n], "fuzz", f);
+	fclose(f);
+	return s;
+}
+
+/* What the program prints along the given path, ending with its error. */
+static char *fuzz_interpret(struct ast *program, enum path path)
+{
+	char *out;
+	size_t len;
+	FILE *f = open_memstream(&out, &len);
+	struct ast *copy = ast_copy(program);
+	struct profile profile = profile_create();
+	struct interpreter i = path == path_reactive ? interpreter_create_reactive(f)
+						     : interpreter_create(f);
+
+	if (path == path_optimized)
+		optimizer_optimize(copy);
+	if (path == path_profiled)
+		i.profile = &profile;
+
+	if (path == path_scheduled)
+		schedule_interpret(&i, copy, THREADS);
+	else
+		interpreter_interpret(&i, copy);
+	if (i.error)
+		diagnostic_print(i.error, f);
+
+	interpreter_destroy(&i);
+	profile_destroy(&profile);
+	ast_destroy(copy);
+	fclose(f);
+	return out;
+}
+
+static char *fuzz_direct(char *input)
+{
+	char *out;
+	size_t len;
+	FILE *f = open_memstream(&out, &len);
+	struct interpreter i = interpreter_create(f);
+	i.budget = &limits;
+	struct parser parser = parser_create_direct(input, &i);
+	struct parser_result res = parser_parse(&parser);
+
+	if (res.error)
+		diagnostic_print(res.error, f);
+
+	parser_destroy(&parser);
+	interpreter_destroy(&i);
+	fclose(f);
+	return out;
+}
+
+static char *read_all(FILE *f, size_t *len)
+{
+	char *buf = NULL;
+	FILE *s = open_memstream(&buf, len);
+	if (s == NULL)
+		return NULL;
+
+	char chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		fwrite(chunk, 1, n, s);
+
+	fclose(s);
+	return buf;
+}
+
+/*
+ * What the program prints compiled with cc, or NULL if it was only generated.
+ * C code that does not compile is a finding, so it aborts.
+ */
+static char *fuzz_compile(struct ast *program, char const *cc)
+{
+	char dir[] = "/tmp/fuzz-XXXXXX";
+	char *source, *binary, *output, *command;
+	if (cc == NULL || mkdtemp(dir) == NULL) {
+		char *out;
+		size_t len;
+		FILE *f = open_memstream(&out, &len);
+		struct compiler c = compiler_create(f);
+		compiler_compile(&c, program);
+		compiler_destroy(&c);
+		fclose(f);
+		free(out);
+		return NULL;
+	}
+
+	asprintf(&source, "%s/out.c", dir);
+	asprintf(&binary, "%s/out", dir);
+	asprintf(&output, "%s/out.txt", dir);
+
+	FILE *f = fopen(source, "w");
+	struct compiler c = compiler_create(f);
+	compiler_compile(&c, program);
+	compiler_destroy(&c);
+	fclose(f);
+
+	asprintf(&command, "%s -O2 -ffp-contract=off -w -o %s %s -lm", cc, binary, source);
+	if (system(command) != 0) {
+		fprintf(stderr, "%s does not compile\n", source);
+		abort();
+	}
+	free(command);
+
+	asprintf(&command, "%s > %s", binary, output);
+	system(command);
+	free(command);
+
+	char *out = NULL;
+	size_t len;
+	f = fopen(output, "r");
+	if (f) {
+		out = read_all(f, &len);
+		fclose(f);
+	}
+
+	remove(source);
+	remove(binary);
+	remove(output);
+	rmdir(dir);
+	free(source);
+	free(binary);
+	free(output);
+	return out ? out : strdup("");
+}
+
+/*
+ * Returns the time in ns spent compiling C code, which says nothing about the
+ * input, so it is left out of its cost.
+ */
+static double fuzz_check(char *input)
+{
+	double compiling = 0;
+	struct parser parser = parser_create(input);
+	parser.budget = &limits;
+	struct parser_result want = parser_parse(&parser);
+	if (parser.exhausted) {
+		parser_destroy(&parser);
+		return compiling;
+	}
+
+	char *parsed = fuzz_parsed(want, &parser.diagnostics);
+
+	struct stream stream = stream_create(input);
+	struct parser streamed = parser_create_stream(&stream);
+	struct parser_result got = parser_parse(&streamed);
+	fuzz_same("stream", parsed, fuzz_parsed(got, &streamed.diagnostics));
+	ast_destroy(got.ast);
+	parser_destroy(&streamed);
+	stream_destroy(&stream);
+
+	struct array_diagnostic diagnostics = { 0 };
+	got = parallel_parse(input, THREADS, &diagnostics);
+	fuzz_same("parallel", parsed, fuzz_parsed(got, &diagnostics));
+	ast_destroy(got.ast);
+	free(diagnostics.elts);
+
+	/* Before a syntax error direct evaluation has run statements already. */
+	char *direct = fuzz_direct(input);
+	if (want.ast) {
+		char *out = fuzz_interpret(want.ast, path_plain);
+		fuzz_same("optimized", out, fuzz_interpret(want.ast, path_optimized));
+		fuzz_same("scheduled", out, fuzz_interpret(want.ast, path_scheduled));
+		fuzz_same("profiled", out, fuzz_interpret(want.ast, path_profiled));
+		fuzz_same("direct", out, direct);
+		free(fuzz_interpret(want.ast, path_reactive));
+		double t = now();
+		char *compiled = fuzz_compile(want.ast, getenv("FUZZ_CC"));
+		compiling = now() - t;
+		if (compiled)
+			fuzz_same("compiled", out, compiled);
+		free(out);
+	} else {
+		free(direct);
+	}
+
+	free(parsed);
+	ast_destroy(want.ast);
+	parser_destroy(&parser);
+	return compiling;
+}
+
+/* Picks up what earlier runs kept, since AFL starts a process per input. */
+static void fuzz_open_slow(void)
+{
+	slow_dir = getenv("FUZZ_SLOW");
+	if (slow_dir == NULL)
+		slow_dir = "slow";
+	if (mkdir(slow_dir, 0777) < 0 && errno != EEXIST)
+		return;
+
+	DIR *dir = opendir(slow_dir);
+	if (dir == NULL)
+		return;
+
+	struct dirent *e;
+	for (size_t n = 0; n < KEEP && (e = readdir(dir));) {
+		double cost;
+		if (sscanf(e->d_name, "%lf-", &cost) != 1)
+			continue;
+
+		slowest[n].cost = cost;
+		asprintf(&slowest[n++].path, "%s/%s", slow_dir, e->d_name);
+	}
+
+	closedir(dir);
+}
+
+/* Keeps the input if it is among the most costly per byte so far. */
+static void fuzz_keep(char const *input, size_t size, double ns, size_t allocs)
+{
+	static unsigned kept;
+
+	if (size < MIN_SLOW_SIZE)
+		return;
+	if (slow_dir == NULL)
+		fuzz_open_slow();
+
+	size_t least = 0;
+	for (size_t n = 1; n < KEEP; n++) {
+		if (slowest[n].cost < slowest[least].cost)
+			least = n;
+	}
+
+	double cost = ns / size;
+	if (cost <= slowest[least].cost)
+		return;
+
+	struct slow *s = &slowest[least];
+	if (s->path) {
+		remove(s->path);
+		free(s->path);
+	}
+
+	s->cost = cost;
+	asprintf(&s->path, "%s/%012.3f-%zu-allocs-%zu-bytes-%d-%u", slow_dir, cost, allocs,
+		 size, (int)getpid(), kept++);
+
+	FILE *f = fopen(s->path, "w");
+	if (f == NULL)
+		return;
+	fwrite(input, 1, size, f);
+	fclose(f);
+}
+
+/* Runs one input, and gives its time in ns and the allocations it made. */
+static double fuzz_input(uint8_t const *data, size_t size, size_t *allocs)
+{
+	/* Fuzz inputs are small, so they would never be cut or run on threads. */
+	parallel_min_chunk = 16;
+	schedule_thresholds = (struct schedule_thresholds) {
+		.min_statements = 2,
+		.batch = 1,
+		.min_batches = 0
+	};
+
+	char *input = strndup((char const *)data, size);
+	size_t len = strlen(input);
+
+#ifdef COUNT_ALLOCATIONS
+	size_t before = allocations;
+#endif
+	double t = now();
+	double compiling = fuzz_check(input);
+	double ns = now() - t - compiling;
+#ifdef COUNT_ALLOCATIONS
+	*allocs = allocations - before;
+#else
+	*allocs = 0;
+#endif
+
+	fuzz_keep(input, len, ns, *allocs);
+	free(input);
+	return ns;
+}
+
+int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size)
+{
+	size_t allocs;
+	fuzz_input(data, size, &allocs);
+	return 0;
+}
+
+#ifndef LIBFUZZER
+static int fuzz_file(FILE *f, char const *name)
+{
+	size_t len;
+	char *data = read_all(f, &len);
+	if (data == NULL) {
+		perror(name);
+		return 1;
+	}
+
+	size_t allocs;
+	double ns = fuzz_input((uint8_t const *)data, len, &allocs);
+	fprintf(stderr, "%s: %zu bytes, %.0f ns, %zu allocations\n", name, len, ns, allocs);
+
+	free(data);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 1)
+		return fuzz_file(stdin, "<stdin>");
+
+	int status = 0;
+	for (int n = 1; n < argc; n++) {
+		FILE *f = fopen(argv[n], "r");
+		if (f == NULL) {
+			perror(argv[n]);
+			status = 1;
+			continue;
+		}
+
+		status |= fuzz_file(f, argv[n]);
+		fclose(f);
+	}
+
+	return status;
+}
+#endif
@@ -2,43 +2,89 @@
 
 #include "interpreter.h"
 #include "ast.h"
+#include "hash.h"
+#include "profile.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
 array_create_declare(struct variable, variable)
 array_destroy_declare(struct variable, variable)
 array_push_declare(struct variable, variable)
+array_destroy_declare(size_t, index)
+array_push_declare(size_t, index)
+array_destroy_declare(struct ast *, ast_p)
+array_push_declare(struct ast *, ast_p)
 
-static void interpreter_statement(struct interpreter *self, struct ast *ast);
+/* Statements are cheap, so a time budget reads the clock only this often. */
+#define CLOCK_EVERY 64
+
+static void interpreter_statement_profiled(struct interpreter *self, struct ast *ast);
+static void interpreter_execute(struct interpreter *self, struct ast *ast);
+static void interpreter_repeat(struct interpreter *self, struct ast *ast);
 static void interpreter_assign(struct interpreter *self, struct ast *ast);
 static void interpreter_print(struct interpreter *self, struct ast *ast);
-static double interpreter_expression(struct interpreter *self, struct ast *ast);
-static double interpreter_name(struct interpreter *self, struct ast *ast);
+static struct value interpreter_expression(struct interpreter *self, struct ast *ast);
+static struct value interpreter_name(struct interpreter *self, struct ast *ast);
+static struct value interpreter_value(struct interpreter *self, size_t var);
+static bool interpreter_push_dirty(struct interpreter *self, struct ast *ast,
+				   struct array_index *stack);
+static void interpreter_assign_formula(struct interpreter *self, char const *name,
+				       struct ast *expression);
+static bool interpreter_resolve(struct interpreter *self, struct ast *ast);
+static bool interpreter_reaches(struct interpreter *self, struct ast *ast, size_t target);
+static void interpreter_link(struct interpreter *self, struct ast *ast, size_t var);
+static void interpreter_unlink(struct interpreter *self, struct ast *ast, size_t var);
+static void interpreter_invalidate(struct interpreter *self, size_t var);
+static void interpreter_error(struct interpreter *self, enum diagnostic_code code,
+			      struct span span);
+static void interpreter_exhaust(struct interpreter *self, enum diagnostic_code code,
+				uint64_t limit);
+static int interpreter_find(struct interpreter *self, char const *name);
+static void interpreter_index_insert(struct interpreter *self, size_t var);
 
 struct interpreter interpreter_create(FILE *output)
 {
 	return (struct interpreter) {
 		.output = output,
 		.variables = array_create_variable(),
+		.index = NULL,
+		.index_size = 0,
 		.error = NULL,
 		.last_var = -1
 	};
 }
 
+struct interpreter interpreter_create_reactive(FILE *output)
+{
+	struct interpreter i = interpreter_create(output);
+	i.reactive = true;
+	return i;
+}
+
 void interpreter_destroy(struct interpreter *self)
 {
-	for (size_t i = 0; i < self->variables.nelts; i++)
-		free(self->variables.elts[i].name);
+	for (size_t i = 0; i < self->variables.nelts; i++) {
+		struct variable *v = &self->variables.elts[i];
+		if (v->name < self->image || v->name >= self->image + self->image_size)
+			free(v->name);
+		if (v->formula)
+			ast_destroy(v->formula);
+		array_destroy_index(v->dependents);
+	}
 
 	array_destroy_variable(self->variables);
-	free(self->error);
+	free(self->index);
+	if (self->image)
+		munmap(self->image, self->image_size);
 }
 
 void interpreter_interpret(struct interpreter *self, struct ast *ast)
 {
-	free(self->error);
 	self->error = NULL;
+	interpreter_begin(self);
 	for (size_t i = 0; i < ast->children.nelts; i++) {
 		interpreter_statement(self, ast->children.elts[i]);
 		if (self->error)
@@ -46,23 +92,119 @@ void interpreter_interpret(struct interpreter *self, struct ast *ast)
 	}
 }
 
-static void interpreter_statement(struct interpreter *i, struct ast *ast)
+void interpreter_statement(struct interpreter *i, struct ast *ast)
+{
+	if (i->budget && !interpreter_spend(i, ast->span))
+		return;
+
+	if (i->profile)
+		interpreter_statement_profiled(i, ast);
+	else
+		interpreter_execute(i, ast);
+}
+
+void interpreter_begin(struct interpreter *self)
+{
+	self->steps = 0;
+	self->deadline = 0;
+	if (self->budget && self->budget->milliseconds)
+		self->deadline = budget_now() + self->budget->milliseconds * 1000000;
+}
+
+bool interpreter_spend(struct interpreter *self, struct span statement)
+{
+	struct budget const *b = self->budget;
+	if (b == NULL)
+		return true;
+
+	self->statement = statement;
+	self->steps++;
+
+	if (b->statements && self->steps > b->statements) {
+		interpreter_exhaust(self, diagnostic_too_many_statements, b->statements);
+		return false;
+	}
+
+	if (self->deadline && self->steps % CLOCK_EVERY == 0 && budget_now() > self->deadline) {
+		interpreter_exhaust(self, diagnostic_too_slow, b->milliseconds);
+		return false;
+	}
+
+	return true;
+}
+
+/* The entry of a repeat is current while its body runs, so it nests. */
+static void interpreter_statement_profiled(struct interpreter *self, struct ast *ast)
+{
+	struct profile *p = self->profile;
+	size_t entry = profile_entry(p, ast) - p->entries.elts;
+	size_t parent = p->current;
+	uint64_t ops = p->ops;
+	uint64_t lookups = p->lookups;
+	struct timespec start, end;
+
+	p->current = entry + 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	interpreter_execute(self, ast);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	p->current = parent;
+
+	struct profile_entry *e = &p->entries.elts[entry];
+	e->count++;
+	e->ns += (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec);
+	e->ops += p->ops - ops;
+	e->lookups += p->lookups - lookups;
+}
+
+static void interpreter_execute(struct interpreter *self, struct ast *ast)
 {
 	if (ast->type == ast_print)
-		interpreter_print(i, ast);
+		interpreter_print(self, ast);
 	else if (ast->type == ast_assign)
-		interpreter_assign(i, ast);
+		interpreter_assign(self, ast);
+	else if (ast->type == ast_repeat)
+		interpreter_repeat(self, ast);
 	else
 		assert(false);
 }
 
+/*
+ * The count is evaluated once; the body is the same tree on every round.
+ * Every round counts as a statement, so that even an empty body is bounded.
+ */
+static void interpreter_repeat(struct interpreter *self, struct ast *ast)
+{
+	struct value count = interpreter_expression(self, ast->children.elts[0]);
+	if (self->error)
+		return;
+
+	int64_t n = value_count(count);
+	if (n < 0) {
+		interpreter_error(self, diagnostic_invalid_count, ast->span);
+		self->diagnostic.got = token_create_number(count);
+		return;
+	}
+
+	struct ast *body = ast->children.elts[1];
+	for (; n > 0; n--) {
+		if (self->budget && !interpreter_spend(self, ast->span))
+			return;
+
+		for (size_t i = 0; i < body->children.nelts; i++) {
+			interpreter_statement(self, body->children.elts[i]);
+			if (self->error)
+				return;
+		}
+	}
+}
+
 static void interpreter_print(struct interpreter *self, struct ast *ast)
 {
-	double n = interpreter_expression(self, ast->children.elts[0]);
+	struct value n = interpreter_expression(self, ast->children.elts[0]);
 	if (self->error)
 		return;
 
-	fprintf(self->output, "%f\n", n);
+	value_print(n, self->output);
 }
 
 static void interpreter_assign(struct interpreter *self, struct ast *ast)
@@ -73,7 +215,8 @@ static void interpreter_assign(struct interpreter *self, struct ast *ast)
 		name = ast->children.elts[0]->name_value;
 	} else if (ast->children.elts[0]->type == ast_het) {
 		if (self->last_var < 0) {
-			self->error = strdup("\"het\" is invalid here");
+			interpreter_error(self, diagnostic_invalid_het,
+					  ast->children.elts[0]->span);
 			return;
 		}
 		name = self->variables.elts[self->last_var].name;
@@ -81,58 +224,380 @@ static void interpreter_assign(struct interpreter *self, struct ast *ast)
 		assert(false);
 	}
 
-	double value = interpreter_expression(self, ast->children.elts[1]);
+	if (self->reactive) {
+		interpreter_assign_formula(self, name, ast->children.elts[1]);
+		return;
+	}
+
+	struct value value = interpreter_expression(self, ast->children.elts[1]);
 
 	if (self->error)
 		return;
 
-	for (size_t i = 0; i < self->variables.nelts; i++) {
-		if (strcmp(self->variables.elts[i].name, name) == 0) {
-			self->variables.elts[i].value = value;
-			self->last_var = i;
+	interpreter_set(self, name, value);
+}
+
+int interpreter_lookup(struct interpreter *self, char const *name)
+{
+	return interpreter_find(self, name);
+}
+
+struct value interpreter_get(struct interpreter *self, size_t var)
+{
+	return interpreter_value(self, var);
+}
+
+void interpreter_set(struct interpreter *self, char const *name, struct value value)
+{
+	int var = interpreter_find(self, name);
+	if (var >= 0) {
+		struct variable *v = &self->variables.elts[var];
+		if (v->formula) {
+			interpreter_unlink(self, v->formula, var);
+			ast_destroy(v->formula);
+			v->formula = NULL;
+			v->dirty = false;
 		}
+
+		v->value = value;
+		self->last_var = var;
+		interpreter_invalidate(self, var);
+		return;
+	}
+
+	struct budget const *b = self->budget;
+	if (b && b->variables && self->variables.nelts >= b->variables) {
+		interpreter_exhaust(self, diagnostic_too_many_variables, b->variables);
+		return;
 	}
 
 	self->last_var = self->variables.nelts;
-	*array_push_variable(&self->variables) = (struct variable) { strdup(name), value };
+	*array_push_variable(&self->variables) = (struct variable) {
+		.name = strdup(name),
+		.value = value
+	};
+	interpreter_index_insert(self, self->last_var);
 }
 
-static double interpreter_expression(struct interpreter *self, struct ast *ast)
+static struct value interpreter_expression(struct interpreter *self, struct ast *ast)
 {
 	switch(ast->type) {
 	case ast_name: return interpreter_name(self, ast);
 	case ast_number: return ast->number_value;
 	case ast_het:
-		if (self->last_var >= 0)
-			return self->variables.elts[self->last_var].value;
+		if (self->last_var >= 0) {
+			if (self->profile) {
+				self->profile->lookups++;
+				profile_variable(self->profile, self->last_var);
+			}
+			return interpreter_value(self, self->last_var);
+		}
 
-		self->error = strdup("\"het\" is invalid here");
-		return 0;
+		interpreter_error(self, diagnostic_invalid_het, ast->span);
+		return value_create_integer(0);
 	}
 
-	double left = interpreter_expression(self, ast->children.elts[0]);
+	if (self->profile)
+		self->profile->ops++;
+
+	struct value left = interpreter_expression(self, ast->children.elts[0]);
 	if (self->error)
-		return 0;
-	double right = interpreter_expression(self, ast->children.elts[1]);
+		return left;
+	struct value right = interpreter_expression(self, ast->children.elts[1]);
 	if (self->error)
-		return 0;
+		return right;
 
 	switch (ast->type) {
-	case ast_plus: return left + right;
-	case ast_minus: return left - right;
-	case ast_star: return left * right;
-	case ast_slash: return left / right;
+	case ast_plus: return value_add(left, right);
+	case ast_minus: return value_subtract(left, right);
+	case ast_star: return value_multiply(left, right);
+	case ast_slash: return value_divide(left, right);
 	default: assert(false);
 	}
 }
 
-static double interpreter_name(struct interpreter *self, struct ast *ast)
+static struct value interpreter_name(struct interpreter *self, struct ast *ast)
 {
-	for (size_t i = 0; i < self->variables.nelts; i++) {
-		if (strcmp(self->variables.elts[i].name, ast->name_value) == 0)
-			return self->variables.elts[i].value;
+	int var = interpreter_find(self, ast->name_value);
+	if (self->profile) {
+		self->profile->lookups++;
+		if (var >= 0)
+			profile_variable(self->profile, var);
+	}
+
+	if (var >= 0)
+		return interpreter_value(self, var);
+
+	interpreter_error(self, diagnostic_undefined_variable, ast->span);
+	diagnostic_set_text(&self->diagnostic, ast->name_value, strlen(ast->name_value));
+	return value_create_integer(-1);
+}
+
+/*
+ * Recomputes a dirty variable from its formula, which cannot fail. The dirty
+ * variables a formula reads are recomputed before it, from a stack rather than
+ * by recursion, since a chain of formulas can be as long as the program.
+ */
+static struct value interpreter_value(struct interpreter *self, size_t var)
+{
+	if (!self->variables.elts[var].dirty)
+		return self->variables.elts[var].value;
+
+	struct array_index stack = { 0 };
+	*array_push_index(&stack) = var;
+
+	while (stack.nelts > 0) {
+		struct variable *v = &self->variables.elts[stack.elts[stack.nelts - 1]];
+		if (v->dirty && interpreter_push_dirty(self, v->formula, &stack))
+			continue;
+
+		if (v->dirty) {
+			v->dirty = false;
+			v->value = interpreter_expression(self, v->formula);
+		}
+		stack.nelts--;
+	}
+
+	array_destroy_index(stack);
+	return self->variables.elts[var].value;
+}
+
+/* Pushes every dirty variable the formula reads, and tells if there were any. */
+static bool interpreter_push_dirty(struct interpreter *self, struct ast *ast,
+				   struct array_index *stack)
+{
+	if (ast->type == ast_number)
+		return false;
+
+	if (ast->type != ast_name) {
+		bool left = interpreter_push_dirty(self, ast->children.elts[0], stack);
+		bool right = interpreter_push_dirty(self, ast->children.elts[1], stack);
+		return left || right;
+	}
+
+	size_t var = interpreter_find(self, ast->name_value);
+	if (!self->variables.elts[var].dirty)
+		return false;
+
+	*array_push_index(stack) = var;
+	return true;
+}
+
+/*
+ * Keeps the formula of an assignment instead of its value. A formula that
+ * reads the variable it assigns, directly or through other formulas, is
+ * evaluated right away, so that the dependencies never form a cycle.
+ */
+static void interpreter_assign_formula(struct interpreter *self, char const *name,
+				       struct ast *expression)
+{
+	struct ast *formula = ast_copy(expression);
+	if (!interpreter_resolve(self, formula)) {
+		ast_destroy(formula);
+		return;
+	}
+
+	int var = interpreter_find(self, name);
+	self->generation++;
+	if (var >= 0 && interpreter_reaches(self, formula, var)) {
+		struct value value = interpreter_expression(self, formula);
+		ast_destroy(formula);
+		interpreter_set(self, name, value);
+		return;
+	}
+
+	interpreter_set(self, name, value_create_integer(0));
+	if (self->error) {
+		ast_destroy(formula);
+		return;
+	}
+
+	struct variable *v = &self->variables.elts[self->last_var];
+	v->formula = formula;
+	v->dirty = true;
+	interpreter_link(self, formula, self->last_var);
+}
+
+/* Replaces "het" by the name it refers to and checks every name exists. */
+static bool interpreter_resolve(struct interpreter *self, struct ast *ast)
+{
+	switch (ast->type) {
+	case ast_number:
+		return true;
+	case ast_name:
+		if (interpreter_find(self, ast->name_value) >= 0)
+			return true;
+
+		interpreter_error(self, diagnostic_undefined_variable, ast->span);
+		diagnostic_set_text(&self->diagnostic, ast->name_value,
+				    strlen(ast->name_value));
+		return false;
+	case ast_het:
+		if (self->last_var < 0) {
+			interpreter_error(self, diagnostic_invalid_het, ast->span);
+			return false;
+		}
+
+		ast->type = ast_name;
+		ast->name_value = strdup(self->variables.elts[self->last_var].name);
+		return true;
+	default:
+		return interpreter_resolve(self, ast->children.elts[0]) &&
+		       interpreter_resolve(self, ast->children.elts[1]);
+	}
+}
+
+/* Follows formulas from a stack, as interpreter_value does. */
+static bool interpreter_reaches(struct interpreter *self, struct ast *ast, size_t target)
+{
+	struct array_ast_p stack = { 0 };
+	bool reaches = false;
+	*array_push_ast_p(&stack) = ast;
+
+	while (!reaches && stack.nelts > 0) {
+		ast = stack.elts[--stack.nelts];
+		if (ast->type == ast_number)
+			continue;
+
+		if (ast->type != ast_name) {
+			*array_push_ast_p(&stack) = ast->children.elts[1];
+			*array_push_ast_p(&stack) = ast->children.elts[0];
+			continue;
+		}
+
+		size_t var = interpreter_find(self, ast->name_value);
+		struct variable *v = &self->variables.elts[var];
+
+		if (var == target) {
+			reaches = true;
+		} else if (v->mark != self->generation) {
+			v->mark = self->generation;
+			if (v->formula)
+				*array_push_ast_p(&stack) = v->formula;
+		}
+	}
+
+	array_destroy_ast_p(stack);
+	return reaches;
+}
+
+static void interpreter_link(struct interpreter *self, struct ast *ast, size_t var)
+{
+	if (ast->type == ast_number)
+		return;
+
+	if (ast->type != ast_name) {
+		interpreter_link(self, ast->children.elts[0], var);
+		interpreter_link(self, ast->children.elts[1], var);
+		return;
+	}
+
+	struct array_index *dependents =
+		&self->variables.elts[interpreter_find(self, ast->name_value)].dependents;
+	for (size_t i = 0; i < dependents->nelts; i++) {
+		if (dependents->elts[i] == var)
+			return;
+	}
+
+	*array_push_index(dependents) = var;
+}
+
+static void interpreter_unlink(struct interpreter *self, struct ast *ast, size_t var)
+{
+	if (ast->type == ast_number)
+		return;
+
+	if (ast->type != ast_name) {
+		interpreter_unlink(self, ast->children.elts[0], var);
+		interpreter_unlink(self, ast->children.elts[1], var);
+		return;
+	}
+
+	struct array_index *dependents =
+		&self->variables.elts[interpreter_find(self, ast->name_value)].dependents;
+	for (size_t i = 0; i < dependents->nelts; i++) {
+		if (dependents->elts[i] == var) {
+			dependents->elts[i] = dependents->elts[--dependents->nelts];
+			return;
+		}
+	}
+}
+
+/* A dirty variable's dependents are always dirty already. */
+static void interpreter_invalidate(struct interpreter *self, size_t var)
+{
+	if (self->variables.elts[var].dependents.nelts == 0)
+		return;
+
+	struct array_index stack = { 0 };
+	*array_push_index(&stack) = var;
+
+	while (stack.nelts > 0) {
+		struct array_index *dependents =
+			&self->variables.elts[stack.elts[--stack.nelts]].dependents;
+
+		for (size_t i = 0; i < dependents->nelts; i++) {
+			struct variable *d = &self->variables.elts[dependents->elts[i]];
+			if (!d->dirty) {
+				d->dirty = true;
+				*array_push_index(&stack) = dependents->elts[i];
+			}
+		}
+	}
+
+	array_destroy_index(stack);
+}
+
+static void interpreter_error(struct interpreter *self, enum diagnostic_code code,
+			      struct span span)
+{
+	self->diagnostic = diagnostic_create(code, span);
+	self->error = &self->diagnostic;
+}
+
+/* Points at the statement being run, since budgets are not spent by one node. */
+static void interpreter_exhaust(struct interpreter *self, enum diagnostic_code code,
+				uint64_t limit)
+{
+	interpreter_error(self, code, self->statement);
+	self->diagnostic.got = token_create_number(value_create_integer(limit));
+}
+
+/*
+ * The variable table is indexed by an open addressing hash table of variable
+ * indices plus one, so that zero marks an empty slot.
+ */
+static int interpreter_find(struct interpreter *self, char const *name)
+{
+	if (self->index_size == 0)
+		return -1;
+
+	size_t mask = self->index_size - 1;
+	for (size_t i = hash_string(name) & mask; self->index[i]; i = (i + 1) & mask) {
+		size_t var = self->index[i] - 1;
+		if (strcmp(self->variables.elts[var].name, name) == 0)
+			return var;
 	}
 
-	asprintf(&self->error, "variable named \"%s\" doesn't exist", ast->name_value);
 	return -1;
 }
+
+static void interpreter_index_insert(struct interpreter *self, size_t var)
+{
+	if ((var + 1) * 2 > self->index_size) {
+		size_t size = self->index_size ? self->index_size * 2 : 16;
+		free(self->index);
+		self->index = calloc(size, sizeof(size_t));
+		self->index_size = size;
+
+		for (size_t i = 0; i < var; i++)
+			interpreter_index_insert(self, i);
+	}
+
+	size_t mask = self->index_size - 1;
+	size_t i = hash_string(self->variables.elts[var].name) & mask;
+	while (self->index[i])
+		i = (i + 1) & mask;
+
+	self->index[i] = var + 1;
+}
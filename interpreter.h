@@ -1,22 +1,69 @@
+#pragma once
+
 #include "array.h"
 #include "ast.h"
+#include "budget.h"
+#include "diagnostic.h"
 #include <stdbool.h>
 #include <stdio.h>
 
+array_declare(size_t, index)
+
+/*
+ * In reactive mode an assigned variable keeps its formula, with "het" already
+ * resolved, and the variables whose formulas mention it. Reassigning a
+ * variable only marks its dependents dirty; they are recomputed when read.
+ */
 struct variable {
 	char *name;
-	double value;
+	struct value value;
+	struct ast *formula;
+	bool dirty;
+	unsigned mark;
+	struct array_index dependents;
 };
 
 array_declare(struct variable, variable)
 
+struct profile;
+
 struct interpreter {
 	FILE *output;
 	struct array_variable variables;
-	char *error;
+	size_t *index;
+	size_t index_size;
+	struct diagnostic const *error;
+	struct diagnostic diagnostic;
 	int last_var;
+	bool reactive;
+	unsigned generation;
+	/* A loaded snapshot, which the names of its variables point into. */
+	char *image;
+	size_t image_size;
+	/* Collects per statement costs when set. */
+	struct profile *profile;
+	/* Limits every run when set, counting from interpreter_begin. */
+	struct budget const *budget;
+	uint64_t steps;
+	uint64_t deadline;
+	/* The statement being run, which budget errors point at. */
+	struct span statement;
 };
 
 struct interpreter interpreter_create(FILE *output);
+struct interpreter interpreter_create_reactive(FILE *output);
 void interpreter_destroy(struct interpreter *i);
 void interpreter_interpret(struct interpreter *i, struct ast *ast);
+/* Runs one statement of a program, which sets error if it fails. */
+void interpreter_statement(struct interpreter *i, struct ast *statement);
+/* Starts a run: its statements and time count against the budget from here. */
+void interpreter_begin(struct interpreter *i);
+/*
+ * Counts a statement against the budget, which interpreter_statement does
+ * itself. Returns false, with error set, once the budget is spent.
+ */
+bool interpreter_spend(struct interpreter *i, struct span statement);
+int interpreter_lookup(struct interpreter *i, char const *name);
+/* Sets error instead if a new variable would exceed the budget. */
+void interpreter_set(struct interpreter *i, char const *name, struct value value);
+struct value interpreter_get(struct interpreter *i, size_t var);
@@ -1,14 +1,11 @@
-#define _GNU_SOURCE
-
 #include "lexer.h"
 #include <ctype.h>
-#include <stdio.h>
+#include <limits.h>
 #include <string.h>
 
-#define MAX_NAME_LENGTH 100
-
 static void lexer_consume(struct lexer *l);
 static char lexer_peek(struct lexer *l);
+static struct token lexer_token(struct lexer *l);
 static struct token lexer_name(struct lexer *l);
 static struct token lexer_number(struct lexer *l);
 
@@ -16,7 +13,21 @@ struct lexer lexer_create(char *input)
 {
 	return (struct lexer) {
 		.input = input,
-		.index = 0
+		.index = 0,
+		.end = INT_MAX,
+		.line = 1,
+		.column = 1
+	};
+}
+
+struct lexer lexer_create_range(char *input, struct span start, int end)
+{
+	return (struct lexer) {
+		.input = input,
+		.index = start.offset,
+		.end = end,
+		.line = start.line,
+		.column = start.column
 	};
 }
 
@@ -25,6 +36,44 @@ struct token lexer_next_token(struct lexer *l)
 	while (isspace(lexer_peek(l)))
 		lexer_consume(l);
 
+	struct span span = {
+		.offset = l->index,
+		.line = l->line,
+		.column = l->column
+	};
+
+	struct token t = lexer_token(l);
+	t.span = span;
+	t.span.length = l->index - span.offset;
+	return t;
+}
+
+char *lexer_statement_end(char *p, char const *end, int *depth)
+{
+	while (p < end) {
+		if (*p == ';' && *depth == 0)
+			return p;
+
+		if (!isalpha(*p)) {
+			p++;
+			continue;
+		}
+
+		char *word = p;
+		while (p < end && isalpha(*p))
+			p++;
+
+		if (p - word == 7 && !memcmp(word, "herhaal", 7))
+			++*depth;
+		else if (p - word == 5 && !memcmp(word, "klaar", 5) && *depth > 0)
+			--*depth;
+	}
+
+	return NULL;
+}
+
+static struct token lexer_token(struct lexer *l)
+{
 	enum token_type type;
 
 	switch (lexer_peek(l)) {
@@ -42,10 +91,8 @@ struct token lexer_next_token(struct lexer *l)
 		} else if (isalpha(lexer_peek(l))) {
 			return lexer_name(l);
 		} else {
-			char *error;
-			asprintf(&error, "Invalid character: '%c'", lexer_peek(l));
 			lexer_consume(l);
-			return token_create_error(error);
+			return token_create_error(token_error_invalid_character);
 		}
 	}
 
@@ -56,59 +103,79 @@ struct token lexer_next_token(struct lexer *l)
 
 static void lexer_consume(struct lexer *l)
 {
-	if (l->input[l->index])
-		l->index++;
+	char c = lexer_peek(l);
+	if (c == '\0')
+		return;
+
+	l->index++;
+	if (c == '\n') {
+		l->line++;
+		l->column = 1;
+	} else {
+		l->column++;
+	}
 }
 
 static char lexer_peek(struct lexer *l)
 {
-	return l->input[l->index];
+	return l->index < l->end ? l->input[l->index] : '\0';
 }
 
 static struct token lexer_name(struct lexer *l)
 {
-	char buf[MAX_NAME_LENGTH + 1] = { 0 };
-
-	for (int i = 0; isalpha(lexer_peek(l)); i++) {
-		if (i >= MAX_NAME_LENGTH) {
-			char *err;
-			asprintf(&err, "Name starting with \"%.10s\" is too long!", buf);
-
-			while (isalpha(lexer_peek(l)))
-				lexer_consume(l);
+	int offset = l->index;
 
-			return token_create_error(err);
-		}
-
-		buf[i] = lexer_peek(l);
+	while (isalpha(lexer_peek(l)))
 		lexer_consume(l);
-	}
 
-	if (!strcmp(buf, "laat"))
+	char const *name = &l->input[offset];
+	int length = l->index - offset;
+
+	if (length > MAX_NAME_LENGTH)
+		return token_create_error(token_error_name_too_long);
+	else if (length == 4 && !memcmp(name, "laat", 4))
 		return token_create(token_laat);
-	else if (!strcmp(buf, "het"))
+	else if (length == 3 && !memcmp(name, "het", 3))
 		return token_create(token_het);
-	else if (!strcmp(buf, "zijn"))
+	else if (length == 4 && !memcmp(name, "zijn", 4))
 		return token_create(token_zijn);
-	else if (!strcmp(buf, "print"))
+	else if (length == 5 && !memcmp(name, "print", 5))
 		return token_create(token_print);
-	else if (!strcmp(buf, "uit"))
+	else if (length == 3 && !memcmp(name, "uit", 3))
 		return token_create(token_uit);
-	else if (!strcmp(buf, "en"))
+	else if (length == 2 && !memcmp(name, "en", 2))
 		return token_create(token_en);
+	else if (length == 7 && !memcmp(name, "herhaal", 7))
+		return token_create(token_herhaal);
+	else if (length == 4 && !memcmp(name, "keer", 4))
+		return token_create(token_keer);
+	else if (length == 5 && !memcmp(name, "klaar", 5))
+		return token_create(token_klaar);
 	else
-		return token_create_name(strdup(buf));
+		return token_create_name(name, length);
 }
 
+/* Literals too large for an integer are read as reals. */
 static struct token lexer_number(struct lexer *l)
 {
-	double n = 0;
+	int64_t n = 0;
+	double real = 0;
+	bool exact = true;
 
 	while (isdigit(lexer_peek(l))) {
-		n *= 10;
-		n += lexer_peek(l) - '0';
+		int digit = lexer_peek(l) - '0';
+
+		if (exact && n <= (INT64_MAX - digit) / 10) {
+			n = n * 10 + digit;
+		} else {
+			if (exact)
+				real = n;
+			exact = false;
+			real = real * 10 + digit;
+		}
+
 		lexer_consume(l);
 	}
 
-	return token_create_number(n);
+	return token_create_number(exact ? value_create_integer(n) : value_create_real(real));
 }
@@ -2,10 +2,23 @@
 
 #include "token.h"
 
+/* The lexer stops at the first NUL byte or at end, whichever comes first. */
 struct lexer {
 	char *input;
 	int index;
+	int end;
+	int line;
+	int column;
 };
 
 struct lexer lexer_create(char *input);
+struct lexer lexer_create_range(char *input, struct span start, int end);
 struct token lexer_next_token(struct lexer *l);
+
+/*
+ * Finds the semicolon that ends the statement at p, skipping those in the
+ * body of a repeat by counting herhaal and klaar the way the parser nests
+ * them. depth is the nesting at p and is kept up to date, so a call can go
+ * on where the previous one stopped. Returns NULL if none comes before end.
+ */
+char *lexer_statement_end(char *p, char const *end, int *depth);
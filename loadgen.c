@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Load generator for main --serve: every client is a thread with its own
+ * session that sends one line at a time and waits for the response.
+ */
+
+struct client {
+	char const *path;
+	size_t nrequests;
+	double *latencies;
+	bool failed;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Sends a line and reads up to and including the NUL that ends the response. */
+static bool request(int fd, char const *line)
+{
+	size_t length = strlen(line);
+	for (size_t sent = 0; sent < length;) {
+		ssize_t n = send(fd, &line[sent], length - sent, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		sent += n;
+	}
+
+	char buf[4096];
+	for (;;) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0)
+			return false;
+		if (memchr(buf, '\0', n))
+			return true;
+	}
+}
+
+static void *client_run(void *arg)
+{
+	struct client *c = arg;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", c->path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    !request(fd, "laat x 0 zijn;\n")) {
+		c->failed = true;
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < c->nrequests; i++) {
+		double t = now();
+		if (!request(fd, "laat x x + 1 zijn; print x * 2 uit;\n")) {
+			c->failed = true;
+			break;
+		}
+		c->latencies[i] = now() - t;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static int compare(void const *a, void const *b)
+{
+	double x = *(double const *)a, y = *(double const *)b;
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+	size_t nclients = 8;
+	size_t nrequests = 10000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nclients = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			nrequests = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1 || nclients == 0 || nrequests == 0)
+		goto usage;
+
+	struct client *clients = calloc(nclients, sizeof(struct client));
+	pthread_t *threads = calloc(nclients, sizeof(pthread_t));
+	bool *started = calloc(nclients, sizeof(bool));
+	double *latencies = calloc(nclients * nrequests, sizeof(double));
+
+	double t = now();
+	for (size_t i = 0; i < nclients; i++) {
+		clients[i] = (struct client) {
+			.path = argv[optind],
+			.nrequests = nrequests,
+			.latencies = &latencies[i * nrequests]
+		};
+		started[i] = pthread_create(&threads[i], NULL, client_run, &clients[i]) == 0;
+		clients[i].failed = !started[i];
+	}
+
+	bool failed = false;
+	for (size_t i = 0; i < nclients; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		failed = failed || clients[i].failed;
+	}
+	double elapsed = now() - t;
+
+	if (failed) {
+		fprintf(stderr, "%s: a client failed to talk to %s\n", argv[0], argv[optind]);
+	} else {
+		size_t total = nclients * nrequests;
+		qsort(latencies, total, sizeof(double), compare);
+		printf("%zu clients, %zu requests in %.2f s\n", nclients, total, elapsed);
+		printf("%-12s %10.1f\n", "requests/s", total / elapsed);
+		printf("%-12s %10.1f us\n", "p50", latencies[total / 2] * 1e6);
+		printf("%-12s %10.1f us\n", "p99", latencies[total * 99 / 100] * 1e6);
+	}
+
+	free(latencies);
+	free(started);
+	free(threads);
+	free(clients);
+	return failed ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-c clients] [-n requests] socket\n", argv[0]);
+	return 2;
+}
@@ -1,43 +1,452 @@
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "compiler.h"
+#include "optimizer.h"
+#include "parallel.h"
 #include "parser.h"
 #include "interpreter.h"
+#include "profile.h"
+#include "schedule.h"
+#include "server.h"
+#include "snapshot.h"
 #include <assert.h>
+#include <getopt.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-int main(void)
+static char *read_all(FILE *f)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *s = open_memstream(&buf, &len);
+	if (s == NULL)
+		return NULL;
+
+	char chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		fwrite(chunk, 1, n, s);
+
+	fclose(s);
+	return buf;
+}
+
+struct options {
+	bool emit_c;
+	bool optimize;
+	bool reactive;
+	bool incremental;
+	bool check;
+	bool stream;
+	bool direct;
+	bool parallel;
+	size_t jobs;
+	char const *load;
+	char const *serve;
+	bool profile;
+	bool folded;
+	struct budget const *budget;
+};
+
+/* Starts a session, from the --load snapshot if there is one. */
+static bool session_create(struct interpreter *i, struct options const *o)
+{
+	*i = o->reactive ? interpreter_create_reactive(stdout) : interpreter_create(stdout);
+	i->budget = o->budget;
+	if (o->load == NULL || snapshot_load(i, o->load) == 0)
+		return true;
+
+	perror(o->load);
+	interpreter_destroy(i);
+	return false;
+}
+
+/* Handles "save <path>" and "load <path>"; other lines are left alone. */
+static bool repl_command(struct interpreter *i, char *line, struct options const *o)
+{
+	bool save = strncmp(line, "save ", 5) == 0;
+	if (!save && strncmp(line, "load ", 5) != 0)
+		return false;
+
+	char *path = &line[5];
+	path[strcspn(path, "\n")] = '\0';
+
+	if (save) {
+		if (snapshot_save(i, path) < 0)
+			perror(path);
+		return true;
+	}
+
+	struct options from = *o;
+	from.load = path;
+
+	struct interpreter loaded;
+	if (session_create(&loaded, &from)) {
+		interpreter_destroy(i);
+		*i = loaded;
+	}
+
+	return true;
+}
+
+static void repl_line(struct interpreter *i, char *line, struct options const *o)
+{
+	struct parser parser = parser_create(line);
+	parser.budget = o->budget;
+	struct parser_result res = parser_parse(&parser);
+
+	if (res.error) {
+		diagnostic_print(res.error, stdout);
+		parser_destroy(&parser);
+		return;
+	}
+
+	if (o->optimize)
+		optimizer_optimize(res.ast);
+
+	interpreter_interpret(i, res.ast);
+	if (i->error)
+		diagnostic_print(i->error, stdout);
+
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+}
+
+/* Runs the line while it is read, without building a tree. */
+static void repl_line_direct(struct interpreter *i, char *line)
+{
+	struct parser parser = parser_create_direct(line, i);
+	struct parser_result res = parser_parse(&parser);
+
+	if (res.error)
+		diagnostic_print(res.error, stdout);
+
+	parser_destroy(&parser);
+}
+
+static void repl_line_cached(struct interpreter *i, struct cache *cache, char *line)
+{
+	struct diagnostic const *error = cache_run(cache, i, line);
+	if (error)
+		diagnostic_print(error, stdout);
+}
+
+static int repl(struct options const *o)
 {
-	char line[1024];
-	struct interpreter i = interpreter_create(stdout);
+	char *line = NULL;
+	size_t size = 0;
+	struct interpreter i;
+	if (!session_create(&i, o))
+		return 1;
+
+	struct cache cache = cache_create();
 
 	for (;;) {
 		fputs("> ", stdout);
 		fflush(stdout);
-		fgets(line, sizeof(line), stdin);
+		if (getline(&line, &size, stdin) < 0)
+			break;
 
 		if (strcmp(line, "q\n") == 0)
 			break;
 
-		struct parser parser = parser_create(line);
-		struct parser_result res = parser_parse(&parser);
-
-		if (res.error) {
-			puts(res.error);
-			free(res.error);
-			parser_destroy(&parser);
+		if (repl_command(&i, line, o))
 			continue;
-		}
 
-		interpreter_interpret(&i, res.ast);
-		if (i.error)
-			puts(i.error);
-
-		ast_destroy(res.ast);
-		parser_destroy(&parser);
+		if (o->incremental)
+			repl_line_cached(&i, &cache, line);
+		else if (o->direct)
+			repl_line_direct(&i, line);
+		else
+			repl_line(&i, line, o);
 	}
 
+	cache_destroy(&cache);
 	interpreter_destroy(&i);
+	free(line);
 
 	return 0;
 }
+
+static struct parser_result script_parse(char *source, struct options const *o,
+					 struct array_diagnostic *diagnostics)
+{
+	/* The chunks of a parallel parse would each get the whole budget. */
+	if (o->parallel && !o->budget)
+		return parallel_parse(source, o->jobs, diagnostics);
+
+	struct stream stream;
+	struct parser parser;
+
+	if (o->stream) {
+		stream = stream_create(source);
+		parser = parser_create_stream(&stream);
+	} else {
+		parser = parser_create(source);
+	}
+
+	parser.budget = o->budget;
+	struct parser_result res = parser_parse(&parser);
+	if (o->stream)
+		stream_destroy(&stream);
+
+	*diagnostics = parser.diagnostics;
+	parser.diagnostics = (struct array_diagnostic) { 0 };
+	parser_destroy(&parser);
+
+	return res;
+}
+
+static int script_direct(char *source, char const *name, struct options const *o)
+{
+	struct interpreter i;
+	if (!session_create(&i, o))
+		return 1;
+
+	struct parser parser = parser_create_direct(source, &i);
+	struct parser_result res = parser_parse(&parser);
+
+	if (res.error)
+		diagnostic_print_at(res.error, name, stdout);
+
+	parser_destroy(&parser);
+	interpreter_destroy(&i);
+
+	return res.error ? 1 : 0;
+}
+
+static int script(FILE *input, char const *name, struct options const *o)
+{
+	char *source = read_all(input);
+	if (source == NULL) {
+		perror("read");
+		return 1;
+	}
+
+	if (o->direct) {
+		int status = script_direct(source, name, o);
+		free(source);
+		return status;
+	}
+
+	struct array_diagnostic diagnostics = { 0 };
+	struct parser_result res = script_parse(source, o, &diagnostics);
+
+	if (res.error || o->check) {
+		for (size_t n = 0; n < diagnostics.nelts; n++)
+			diagnostic_print_at(&diagnostics.elts[n], name, stdout);
+
+		if (res.ast)
+			ast_destroy(res.ast);
+		free(diagnostics.elts);
+		free(source);
+		return res.error ? 1 : 0;
+	}
+
+	if (o->optimize)
+		optimizer_optimize(res.ast);
+
+	int status = 0;
+	struct interpreter i;
+	if (o->emit_c) {
+		struct compiler c = compiler_create(stdout);
+		compiler_compile(&c, res.ast);
+		compiler_destroy(&c);
+	} else if (!session_create(&i, o)) {
+		status = 1;
+	} else {
+		struct profile profile = profile_create();
+		if (o->profile)
+			i.profile = &profile;
+
+		/* The scheduler does not time statements, so profiling runs them in order. */
+		if (o->parallel && !o->reactive && !o->profile)
+			schedule_interpret(&i, res.ast, o->jobs);
+		else
+			interpreter_interpret(&i, res.ast);
+		if (i.error) {
+			diagnostic_print_at(i.error, name, stdout);
+			status = 1;
+		}
+
+		if (o->folded)
+			profile_collapsed(&profile, name, stderr);
+		else if (o->profile)
+			profile_report(&profile, &i, name, stderr);
+
+		profile_destroy(&profile);
+		interpreter_destroy(&i);
+	}
+
+	ast_destroy(res.ast);
+	free(diagnostics.elts);
+	free(source);
+
+	return status;
+}
+
+static struct server server;
+
+static void serve_signal(int sig)
+{
+	(void)sig;
+	server_stop(&server);
+}
+
+static int serve(struct options const *o)
+{
+	if (server_open(&server, o->serve, o->jobs) < 0) {
+		perror(o->serve);
+		return 1;
+	}
+	server.reactive = o->reactive;
+	server.budget = o->budget;
+
+	struct sigaction sa = { .sa_handler = serve_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	int status = server_run(&server);
+	if (status < 0)
+		perror("server");
+
+	server_close(&server);
+	return status < 0 ? 1 : 0;
+}
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr, "usage: %s [-O | [-r] [-i]] [-j jobs] [--stream] [--load snapshot]\n"
+		"       [--profile[=folded]] [--budget limits] [--emit-c | --check] [file]\n"
+		"       %s --direct [--load snapshot] [--budget limits] [file]\n"
+		"       %s [-r] [-j workers] [--budget limits] --serve socket\n", argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option const options[] = {
+		{ "emit-c", no_argument, NULL, 'c' },
+		{ "optimize", no_argument, NULL, 'O' },
+		{ "incremental", no_argument, NULL, 'i' },
+		{ "reactive", no_argument, NULL, 'r' },
+		{ "check", no_argument, NULL, 'k' },
+		{ "stream", no_argument, NULL, 's' },
+		{ "direct", no_argument, NULL, 'd' },
+		{ "jobs", required_argument, NULL, 'j' },
+		{ "load", required_argument, NULL, 'l' },
+		{ "serve", required_argument, NULL, 'S' },
+		{ "profile", optional_argument, NULL, 'p' },
+		{ "budget", required_argument, NULL, 'b' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	struct options o = { 0 };
+	struct budget budget;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "Oirj:", options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			o.emit_c = true;
+			break;
+		case 'O':
+			o.optimize = true;
+			break;
+		case 'i':
+			o.incremental = true;
+			break;
+		case 'r':
+			o.reactive = true;
+			break;
+		case 'k':
+			o.check = true;
+			break;
+		case 's':
+			o.stream = true;
+			break;
+		case 'd':
+			o.direct = true;
+			break;
+		case 'l':
+			o.load = optarg;
+			break;
+		case 'S':
+			o.serve = optarg;
+			break;
+		case 'p':
+			if (optarg && strcmp(optarg, "folded") != 0) {
+				usage(argv[0]);
+				return 2;
+			}
+			o.profile = true;
+			o.folded = optarg != NULL;
+			break;
+		case 'b':
+			if (budget_parse(&budget, optarg) < 0) {
+				usage(argv[0]);
+				return 2;
+			}
+			o.budget = &budget;
+			break;
+		case 'j':
+			o.parallel = true;
+			o.jobs = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	/*
+	 * Formulas are kept as written, which neither -O nor C code can follow,
+	 * and C code cannot start from a snapshot. A cached statement is shared
+	 * by every line it is in, so -O cannot rewrite it for one of them.
+	 */
+	if (optind < argc - 1 || (o.reactive && (o.optimize || o.emit_c)) ||
+	    (o.incremental && o.optimize) || (o.load && o.emit_c) ||
+	    (o.profile && (optind == argc || o.emit_c))) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	/* Direct evaluation leaves no tree for the other modes to work on. */
+	if (o.direct && (o.optimize || o.reactive || o.incremental || o.check || o.emit_c ||
+			 o.stream || o.parallel || o.profile || o.serve)) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if (o.serve) {
+		if (optind < argc || o.emit_c || o.check || o.load || o.optimize) {
+			usage(argv[0]);
+			return 2;
+		}
+		return serve(&o);
+	}
+
+	if (optind == argc && !o.emit_c && !o.check)
+		return repl(&o);
+
+	FILE *input = stdin;
+	char const *name = "<stdin>";
+	if (optind < argc && strcmp(argv[optind], "-") != 0) {
+		name = argv[optind];
+		input = fopen(name, "r");
+		if (input == NULL) {
+			perror(name);
+			return 1;
+		}
+	}
+
+	int status = script(input, name, &o);
+
+	if (input != stdin)
+		fclose(input);
+
+	return status;
+}
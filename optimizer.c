@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+
+#include "optimizer.h"
+#include "ast.h"
+#include "hash.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Older available expressions are forgotten so a pass stays linear. */
+#define MAX_AVAILABLE 64
+
+struct available {
+	struct ast *expr;
+	char *holder;
+};
+
+/*
+ * A set of names, which it does not own, hashed by their text. A removed name
+ * leaves a tombstone, and clearing starts over small, so that a set that is
+ * emptied often costs no more than what was put in it.
+ */
+struct names {
+	char **slots;
+	size_t size;
+	size_t used;
+};
+
+array_declare(bool, bool)
+array_create_declare(bool, bool)
+array_destroy_declare(bool, bool)
+array_push_declare(bool, bool)
+
+/* The variables set in a repeat body include those set before it, in outer. */
+struct optimizer {
+	struct names defined;
+	struct optimizer const *outer;
+	struct available available[MAX_AVAILABLE];
+	size_t navailable;
+	char *last;
+};
+
+static void optimizer_program(struct ast *program, struct optimizer const *outer);
+static bool optimizer_forward(struct optimizer *self, struct ast *stmt);
+static bool optimizer_repeat(struct optimizer *self, struct ast *stmt);
+static void optimizer_backward(struct ast *program, struct array_bool *may_fail);
+static void optimizer_resolve_het(struct optimizer *self, struct ast **a);
+static void optimizer_reuse(struct optimizer *self, struct ast **a);
+static void optimizer_kill(struct optimizer *self, char const *name);
+static void optimizer_kill_all(struct optimizer *self);
+static bool optimizer_may_fail(struct optimizer *self, struct ast *a);
+static bool optimizer_defined(struct optimizer const *self, char const *name);
+static struct names names_create(void);
+static void names_destroy(struct names *names);
+static char **names_find(struct names const *names, char const *name);
+static void names_add(struct names *names, char *name);
+static void names_clear(struct names *names);
+static void names_remove_read(struct names *names, struct ast *a);
+
+void optimizer_optimize(struct ast *program)
+{
+	optimizer_program(program, NULL);
+}
+
+/* The names defined in outer, if given, are known to be set before the program runs. */
+static void optimizer_program(struct ast *program, struct optimizer const *outer)
+{
+	struct optimizer self = {
+		.defined = names_create(),
+		.outer = outer
+	};
+	struct array_bool may_fail = array_create_bool();
+
+	for (size_t i = 0; i < program->children.nelts; i++)
+		*array_push_bool(&may_fail) =
+			optimizer_forward(&self, program->children.elts[i]);
+
+	optimizer_backward(program, &may_fail);
+
+	optimizer_kill_all(&self);
+	array_destroy_bool(may_fail);
+	names_destroy(&self.defined);
+}
+
+/*
+ * Resolves "het" and reuses available expressions in one statement. Returns
+ * whether the statement could stop the program with an error.
+ */
+static bool optimizer_forward(struct optimizer *self, struct ast *stmt)
+{
+	if (stmt->type == ast_repeat)
+		return optimizer_repeat(self, stmt);
+
+	struct ast **value = &stmt->children.elts[stmt->children.nelts - 1];
+
+	optimizer_resolve_het(self, value);
+	optimizer_reuse(self, value);
+
+	bool may_fail = optimizer_may_fail(self, *value);
+
+	if (stmt->type != ast_assign)
+		return may_fail;
+
+	struct ast **assignee = &stmt->children.elts[0];
+	optimizer_resolve_het(self, assignee);
+
+	if ((*assignee)->type == ast_het) {
+		/* Some unknown variable changes, so nothing stays available. */
+		optimizer_kill_all(self);
+		return true;
+	}
+
+	char *name = (*assignee)->name_value;
+	optimizer_kill(self, name);
+
+	if ((*value)->children.nelts > 0 && !ast_mentions(*value, name)) {
+		if (self->navailable == MAX_AVAILABLE) {
+			ast_destroy(self->available[0].expr);
+			memmove(&self->available[0], &self->available[1],
+				sizeof(struct available) * (MAX_AVAILABLE - 1));
+			self->navailable--;
+		}
+
+		self->available[self->navailable++] = (struct available) {
+			.expr = ast_copy(*value),
+			.holder = name
+		};
+	}
+
+	names_add(&self->defined, name);
+	self->last = name;
+
+	return may_fail;
+}
+
+/*
+ * Every round of a repeat starts from what the previous one left, so its body
+ * is optimized as a program of its own, and nothing is known once it is done.
+ */
+static bool optimizer_repeat(struct optimizer *self, struct ast *stmt)
+{
+	struct ast **count = &stmt->children.elts[0];
+
+	optimizer_resolve_het(self, count);
+	optimizer_reuse(self, count);
+
+	optimizer_program(stmt->children.elts[1], self);
+
+	optimizer_kill_all(self);
+	self->last = NULL;
+	return true;
+}
+
+/*
+ * Walks the program backwards and drops assignments whose variable is
+ * assigned again before anything reads it. A statement that may fail ends
+ * the search, since the program could stop there with the old value set.
+ */
+static void optimizer_backward(struct ast *program, struct array_bool *may_fail)
+{
+	struct names overwritten = names_create();
+	size_t kept = program->children.nelts;
+
+	for (size_t i = program->children.nelts; i-- > 0;) {
+		struct ast *stmt = program->children.elts[i];
+		bool fails = may_fail->elts[i];
+
+		if (stmt->type == ast_assign && !fails &&
+		    names_find(&overwritten, stmt->children.elts[0]->name_value)) {
+			ast_destroy(stmt);
+			continue;
+		}
+
+		if (fails)
+			names_clear(&overwritten);
+		else if (stmt->type == ast_assign)
+			names_add(&overwritten, stmt->children.elts[0]->name_value);
+
+		names_remove_read(&overwritten, stmt->children.elts[stmt->children.nelts - 1]);
+		program->children.elts[--kept] = stmt;
+	}
+
+	memmove(program->children.elts, &program->children.elts[kept],
+		sizeof(struct ast *) * (program->children.nelts - kept));
+	program->children.nelts -= kept;
+
+	names_destroy(&overwritten);
+}
+
+static void optimizer_resolve_het(struct optimizer *self, struct ast **a)
+{
+	if ((*a)->type == ast_het) {
+		if (self->last) {
+			struct ast *name = ast_create_name(strdup(self->last));
+			name->span = (*a)->span;
+			ast_destroy(*a);
+			*a = name;
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < (*a)->children.nelts; i++)
+		optimizer_resolve_het(self, &(*a)->children.elts[i]);
+}
+
+static void optimizer_reuse(struct optimizer *self, struct ast **a)
+{
+	if ((*a)->children.nelts == 0)
+		return;
+
+	for (size_t i = self->navailable; i-- > 0;) {
+		if (ast_equal(*a, self->available[i].expr)) {
+			struct ast *name = ast_create_name(strdup(self->available[i].holder));
+			name->span = (*a)->span;
+			ast_destroy(*a);
+			*a = name;
+			return;
+		}
+	}
+
+	for (size_t i = 0; i < (*a)->children.nelts; i++)
+		optimizer_reuse(self, &(*a)->children.elts[i]);
+}
+
+static void optimizer_kill(struct optimizer *self, char const *name)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < self->navailable; i++) {
+		struct available *av = &self->available[i];
+		if (strcmp(av->holder, name) == 0 || ast_mentions(av->expr, name))
+			ast_destroy(av->expr);
+		else
+			self->available[kept++] = *av;
+	}
+
+	self->navailable = kept;
+}
+
+static void optimizer_kill_all(struct optimizer *self)
+{
+	for (size_t i = 0; i < self->navailable; i++)
+		ast_destroy(self->available[i].expr);
+
+	self->navailable = 0;
+}
+
+static bool optimizer_may_fail(struct optimizer *self, struct ast *a)
+{
+	if (a->type == ast_het)
+		return true;
+	if (a->type == ast_name)
+		return !optimizer_defined(self, a->name_value);
+
+	for (size_t i = 0; i < a->children.nelts; i++) {
+		if (optimizer_may_fail(self, a->children.elts[i]))
+			return true;
+	}
+
+	return false;
+}
+
+static bool optimizer_defined(struct optimizer const *self, char const *name)
+{
+	for (; self; self = self->outer) {
+		if (names_find(&self->defined, name))
+			return true;
+	}
+
+	return false;
+}
+
+static char names_tombstone[1];
+
+static struct names names_create(void)
+{
+	return (struct names) {
+		.slots = calloc(16, sizeof(char *)),
+		.size = 16,
+		.used = 0
+	};
+}
+
+static void names_destroy(struct names *self)
+{
+	free(self->slots);
+}
+
+/* The slot that holds name, or NULL. */
+static char **names_find(struct names const *self, char const *name)
+{
+	size_t mask = self->size - 1;
+
+	for (size_t i = hash_string(name) & mask; self->slots[i]; i = (i + 1) & mask) {
+		if (self->slots[i] != names_tombstone && strcmp(self->slots[i], name) == 0)
+			return &self->slots[i];
+	}
+
+	return NULL;
+}
+
+static void names_add(struct names *self, char *name)
+{
+	if (names_find(self, name))
+		return;
+
+	/* Tombstones count as used, so a rehash also sweeps them out. */
+	if ((self->used + 1) * 2 > self->size) {
+		struct names old = *self;
+		size_t live = 0;
+		for (size_t i = 0; i < old.size; i++)
+			live += old.slots[i] && old.slots[i] != names_tombstone;
+
+		self->size = 16;
+		while ((live + 1) * 4 > self->size)
+			self->size *= 2;
+		self->slots = calloc(self->size, sizeof(char *));
+		self->used = 0;
+
+		for (size_t i = 0; i < old.size; i++) {
+			if (old.slots[i] && old.slots[i] != names_tombstone)
+				names_add(self, old.slots[i]);
+		}
+		names_destroy(&old);
+	}
+
+	size_t mask = self->size - 1;
+	size_t i = hash_string(name) & mask;
+	while (self->slots[i] && self->slots[i] != names_tombstone)
+		i = (i + 1) & mask;
+
+	if (self->slots[i] == NULL)
+		self->used++;
+	self->slots[i] = name;
+}
+
+static void names_clear(struct names *self)
+{
+	if (self->used == 0)
+		return;
+
+	names_destroy(self);
+	*self = names_create();
+}
+
+static void names_remove_read(struct names *names, struct ast *a)
+{
+	if (a->type == ast_name) {
+		char **slot = names_find(names, a->name_value);
+		if (slot)
+			*slot = names_tombstone;
+	}
+
+	for (size_t i = 0; i < a->children.nelts; i++)
+		names_remove_read(names, a->children.elts[i]);
+}
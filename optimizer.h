@@ -0,0 +1,15 @@
+#pragma once
+
+#include "ast.h"
+
+/*
+ * Rewrites a program in place without changing what it prints, which error it
+ * stops on, or the variables it leaves behind:
+ *  - "het" is replaced by the name it refers to wherever that is known,
+ *  - a subexpression that an earlier assignment already computed is replaced
+ *    by that variable, as long as neither it nor the operands changed since,
+ *  - assignments that are overwritten before being read are dropped.
+ * The body of a repeat is optimized the same way on its own. Only which
+ * variables are set carries over into it, and nothing past it.
+ */
+void optimizer_optimize(struct ast *program);
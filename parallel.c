@@ -0,0 +1,270 @@
+#define _GNU_SOURCE
+
+#include "parallel.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+size_t parallel_min_chunk = 64 * 1024;
+
+struct chunk {
+	char *input;
+	int begin;
+	int end;
+	int newlines;
+	int last_newline;
+	int closed;
+	int opened;
+	struct span start;
+	struct parser_result result;
+	struct array_diagnostic diagnostics;
+};
+
+array_push_declare(struct diagnostic, diagnostic)
+
+static size_t split(char *input, size_t nthreads, struct chunk **chunks);
+static size_t join(struct chunk *chunks, size_t n);
+static void run(struct chunk *chunks, size_t n, void *(*fn)(void *));
+static void *chunk_count(void *arg);
+static void chunk_nesting(struct chunk *c);
+static void *chunk_parse(void *arg);
+
+struct parser_result parallel_parse(char *input, size_t nthreads,
+				    struct array_diagnostic *diagnostics)
+{
+	if (nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	struct chunk *chunks;
+	size_t n = split(input, nthreads, &chunks);
+
+	run(chunks, n, chunk_count);
+	n = join(chunks, n);
+
+	struct span start = { .line = 1, .column = 1 };
+	int last_newline = -1;
+	for (size_t i = 0; i < n; i++) {
+		start.offset = chunks[i].begin;
+		start.column = chunks[i].begin - last_newline;
+		chunks[i].start = start;
+
+		start.line += chunks[i].newlines;
+		if (chunks[i].last_newline >= 0)
+			last_newline = chunks[i].last_newline;
+	}
+
+	run(chunks, n, chunk_parse);
+
+	struct ast *program = NULL;
+	size_t first_error = diagnostics->nelts;
+
+	for (size_t i = 0; i < n; i++) {
+		struct chunk *c = &chunks[i];
+
+		for (size_t d = 0; d < c->diagnostics.nelts; d++)
+			*array_push_diagnostic(diagnostics) = c->diagnostics.elts[d];
+		free(c->diagnostics.elts);
+
+		if (c->result.error)
+			continue;
+
+		if (program == NULL) {
+			program = c->result.ast;
+			continue;
+		}
+
+		for (size_t s = 0; s < c->result.ast->children.nelts; s++)
+			ast_add_child(program, c->result.ast->children.elts[s]);
+
+		c->result.ast->children.nelts = 0;
+		ast_destroy(c->result.ast);
+	}
+
+	free(chunks);
+
+	if (diagnostics->nelts > first_error) {
+		if (program)
+			ast_destroy(program);
+
+		return (struct parser_result) {
+			.error = &diagnostics->elts[first_error]
+		};
+	}
+
+	return (struct parser_result) {
+		.ast = program
+	};
+}
+
+/*
+ * Cuts the input just after a semicolon near every nth part of it. A cut may
+ * fall inside the body of a repeat; join undoes those once the chunks are
+ * counted.
+ */
+static size_t split(char *input, size_t nthreads, struct chunk **chunks)
+{
+	size_t len = strlen(input);
+	size_t n = len / parallel_min_chunk;
+	if (n > nthreads)
+		n = nthreads;
+	if (n == 0)
+		n = 1;
+
+	*chunks = calloc(n, sizeof(struct chunk));
+
+	size_t nchunks = 0;
+	size_t begin = 0;
+
+	for (size_t k = 1; k < n; k++) {
+		size_t target = len * k / n;
+		if (target < begin)
+			continue;
+
+		char *semicolon = memchr(&input[target], ';', len - target);
+		if (semicolon == NULL)
+			break;
+
+		size_t end = semicolon - input + 1;
+		(*chunks)[nchunks++] = (struct chunk) {
+			.input = input,
+			.begin = begin,
+			.end = end
+		};
+		begin = end;
+	}
+
+	(*chunks)[nchunks++] = (struct chunk) {
+		.input = input,
+		.begin = begin,
+		.end = len
+	};
+
+	return nchunks;
+}
+
+/*
+ * Joins every chunk that ends inside the body of a repeat to the next one, so
+ * that each chunk holds whole statements. Returns the number of chunks left.
+ */
+static size_t join(struct chunk *chunks, size_t n)
+{
+	size_t kept = 0;
+	int depth = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		struct chunk *c = &chunks[i];
+		bool inside = depth > 0;
+		depth = (depth > c->closed ? depth - c->closed : 0) + c->opened;
+
+		if (!inside) {
+			chunks[kept++] = *c;
+			continue;
+		}
+
+		struct chunk *last = &chunks[kept - 1];
+		last->end = c->end;
+		last->newlines += c->newlines;
+		if (c->last_newline >= 0)
+			last->last_newline = c->last_newline;
+	}
+
+	return kept;
+}
+
+/* Runs fn on every chunk, one thread per chunk besides the calling one. */
+static void run(struct chunk *chunks, size_t n, void *(*fn)(void *))
+{
+	pthread_t *threads = calloc(n, sizeof(pthread_t));
+	bool *started = calloc(n, sizeof(bool));
+
+	for (size_t i = 1; i < n; i++)
+		started[i] = pthread_create(&threads[i], NULL, fn, &chunks[i]) == 0;
+
+	fn(&chunks[0]);
+
+	for (size_t i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			fn(&chunks[i]);
+	}
+
+	free(started);
+	free(threads);
+}
+
+static void *chunk_count(void *arg)
+{
+	struct chunk *c = arg;
+	char *p = &c->input[c->begin];
+	char *end = &c->input[c->end];
+
+	c->newlines = 0;
+	c->last_newline = -1;
+
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		c->newlines++;
+		c->last_newline = p - c->input;
+		p++;
+	}
+
+	chunk_nesting(c);
+	return NULL;
+}
+
+/*
+ * Sums up how the chunk nests repeats, counting herhaal and klaar the way
+ * lexer_statement_end does: entered at depth d, it is left at
+ * max(d - closed, 0) + opened.
+ */
+static void chunk_nesting(struct chunk *c)
+{
+	char *p = &c->input[c->begin];
+	char *end = &c->input[c->end];
+	int depth = 0;
+
+	c->closed = 0;
+	c->opened = 0;
+
+	/* Most inputs have no repeats, and memmem is faster than reading words. */
+	if (!memmem(p, end - p, "herhaal", 7) && !memmem(p, end - p, "klaar", 5))
+		return;
+
+	while (p < end) {
+		if (!isalpha(*p)) {
+			p++;
+			continue;
+		}
+
+		char *word = p;
+		while (p < end && isalpha(*p))
+			p++;
+
+		if (p - word == 7 && !memcmp(word, "herhaal", 7))
+			depth++;
+		else if (p - word == 5 && !memcmp(word, "klaar", 5) && depth == 0)
+			c->closed++;
+		else if (p - word == 5 && !memcmp(word, "klaar", 5))
+			depth--;
+	}
+
+	c->opened = depth;
+}
+
+static void *chunk_parse(void *arg)
+{
+	struct chunk *c = arg;
+	struct parser parser = parser_create_range(c->input, c->start, c->end);
+
+	c->result = parser_parse(&parser);
+
+	/* Move the diagnostics so that the result can keep pointing at them. */
+	c->diagnostics = parser.diagnostics;
+	parser.diagnostics = (struct array_diagnostic) { 0 };
+	parser_destroy(&parser);
+
+	return NULL;
+}
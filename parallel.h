@@ -0,0 +1,23 @@
+#pragma once
+
+#include "parser.h"
+
+/*
+ * Parses a large input on several threads. The input is cut into chunks just
+ * after a semicolon outside any repeat, each chunk is lexed and parsed on its
+ * own thread, and the statements are joined into one program in source order.
+ * Since the parser recovers at those semicolons as well, the program and the
+ * diagnostics are the same as those of a single parser_parse over the whole
+ * input.
+ *
+ * Diagnostics are appended to the given array, which the caller frees; a
+ * returned error points at its first element.
+ */
+struct parser_result parallel_parse(char *input, size_t nthreads,
+				    struct array_diagnostic *diagnostics);
+
+/*
+ * Inputs are not cut into chunks smaller than this. The fuzzer lowers it so
+ * that its small inputs are cut as well.
+ */
+extern size_t parallel_min_chunk;
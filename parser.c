@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 
 #include "ast.h"
+#include "interpreter.h"
 #include "parser.h"
 #include <assert.h>
 #include <stdbool.h>
@@ -8,37 +9,84 @@
 #include <stdio.h>
 #include <string.h>
 
+array_push_declare(struct diagnostic, diagnostic)
+
 struct infix_bp {
 	int left;
 	int right;
 };
 
 static struct parser_result parser_result_create(struct ast *a);
-static struct parser_result parser_result_create_error(char *e);
+static struct parser_result parser_result_create_error(struct parser *self);
 static struct parser_result parser_error(struct parser *self, char const *want);
 static struct parser_result parser_error_lookahead(struct parser *self);
 static struct parser_result parser_error_type(struct parser *self, enum token_type t);
 static void parser_consume(struct parser *self);
+static void parser_recover(struct parser *self, int depth);
 static bool parser_expect(struct parser *self, enum token_type type);
 static struct parser_result parser_program(struct parser *self);
+static struct parser_result parser_run(struct parser *self);
+static struct parser_result parser_execute(struct parser *self, struct parser_result statement,
+					  struct span span);
+static void parser_fail(struct parser *self, enum diagnostic_code code, struct span span);
+static bool parser_spend(struct parser *self, size_t nodes);
+static bool parser_nest(struct parser *self, size_t height);
+static void parser_exhaust(struct parser *self, enum diagnostic_code code, size_t limit);
 static struct parser_result parser_statement(struct parser *self);
 static struct parser_result parser_assign(struct parser *self);
 static struct parser_result parser_print(struct parser *self);
+static struct parser_result parser_repeat(struct parser *self);
 static struct parser_result parser_expression(struct parser *self, int min_bp);
 static struct parser_result parser_primary(struct parser *self);
+static struct parser_result parser_primary_value(struct parser *self);
+static struct value parser_apply(enum token_type op, struct value left, struct value right);
 static struct infix_bp get_infix_bp(enum token_type t);
 
 struct parser parser_create(char *input)
 {
-	struct parser p;
-	p.input = lexer_create(input);
+	struct parser p = {
+		.input = lexer_create(input)
+	};
+
+	p.lookahead = lexer_next_token(&p.input);
+	p.diagnostic = diagnostic_create(diagnostic_none, p.lookahead.span);
+	return p;
+}
+
+struct parser parser_create_range(char *input, struct span start, int end)
+{
+	struct parser p = {
+		.input = lexer_create_range(input, start, end)
+	};
+
 	p.lookahead = lexer_next_token(&p.input);
+	p.diagnostic = diagnostic_create(diagnostic_none, p.lookahead.span);
+	return p;
+}
+
+struct parser parser_create_stream(struct stream const *stream)
+{
+	struct parser p = {
+		.input = lexer_create(stream->input),
+		.stream = stream
+	};
+
+	p.lookahead = stream_next(stream, &p.cursor);
+	p.diagnostic = diagnostic_create(diagnostic_none, p.lookahead.span);
+	return p;
+}
+
+struct parser parser_create_direct(char *input, struct interpreter *i)
+{
+	struct parser p = parser_create(input);
+	p.interpreter = i;
+	p.budget = i->budget;
 	return p;
 }
 
 void parser_destroy(struct parser *self)
 {
-	token_destroy(&self->lookahead);
+	free(self->diagnostics.elts);
 }
 
 static struct parser_result parser_result_create(struct ast *a)
@@ -48,28 +96,38 @@ static struct parser_result parser_result_create(struct ast *a)
 	};
 }
 
-static struct parser_result parser_result_create_error(char *e)
+static struct parser_result parser_result_create_error(struct parser *self)
 {
 	return (struct parser_result) {
-		.error = e
+		.error = &self->diagnostic
 	};
 }
 
 static struct parser_result parser_error_lookahead(struct parser *self)
 {
-	return parser_result_create_error(strdup(self->lookahead.error));
+	struct token t = self->lookahead;
+	enum diagnostic_code code = t.error == token_error_invalid_character
+				    ? diagnostic_invalid_character
+				    : diagnostic_name_too_long;
+
+	self->diagnostic = diagnostic_create(code, t.span);
+	diagnostic_set_text(&self->diagnostic, &self->input.input[t.span.offset],
+			    code == diagnostic_invalid_character ? 1 : 10);
+	return parser_result_create_error(self);
 }
 
 static struct parser_result parser_error(struct parser *self, char const *want)
 {
-	if (self->lookahead.error)
+	if (self->lookahead.type == token_none)
 		return parser_error_lookahead(self);
 
-	char *error;
-	char *tokenstring = token_to_string(self->lookahead);
-	asprintf(&error, "Want %s, got %s.", want, tokenstring);
-	free(tokenstring);
-	return parser_result_create_error(error);
+	struct token t = self->lookahead;
+	self->diagnostic = diagnostic_create(diagnostic_unexpected_token, t.span);
+	self->diagnostic.want = want;
+	self->diagnostic.got = t;
+	if (t.type == token_name)
+		diagnostic_set_text(&self->diagnostic, t.name_value, t.name_length);
+	return parser_result_create_error(self);
 }
 
 static struct parser_result parser_error_type(struct parser *self,
@@ -80,14 +138,79 @@ static struct parser_result parser_error_type(struct parser *self,
 
 static void parser_consume(struct parser *self)
 {
-	token_destroy(&self->lookahead);
-	self->lookahead = lexer_next_token(&self->input);
+	if (self->stream)
+		self->lookahead = stream_next(self->stream, &self->cursor);
+	else
+		self->lookahead = lexer_next_token(&self->input);
+}
+
+/*
+ * Remembers the current error and skips past the end of the statement, which
+ * is the first semicolon outside every repeat it opened. In the body of a
+ * repeat, which is at the given depth, it stops at the klaar that ends it.
+ */
+static void parser_recover(struct parser *self, int depth)
+{
+	*array_push_diagnostic(&self->diagnostics) = self->diagnostic;
+	if (self->exhausted)
+		return;
+
+	for (;; parser_consume(self)) {
+		switch (self->lookahead.type) {
+		case token_end:
+			return;
+		case token_semicolon:
+			if (self->depth == depth) {
+				parser_consume(self);
+				return;
+			}
+			break;
+		case token_herhaal:
+			self->depth++;
+			break;
+		case token_klaar:
+			if (self->depth == depth && depth > 0)
+				return;
+			if (self->depth > depth)
+				self->depth--;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* Counts nodes against the budget; once it is spent, the parse ends. */
+static bool parser_spend(struct parser *self, size_t nodes)
+{
+	self->nodes += nodes;
+	if (self->budget == NULL || self->budget->nodes == 0 || self->nodes <= self->budget->nodes)
+		return true;
+
+	parser_exhaust(self, diagnostic_too_many_nodes, self->budget->nodes);
+	return false;
+}
+
+/* Checks an expression of the given height against the depth budget. */
+static bool parser_nest(struct parser *self, size_t height)
+{
+	if (self->budget == NULL || self->budget->depth == 0 ||
+	    self->depth + self->parens + height <= self->budget->depth)
+		return true;
+
+	parser_exhaust(self, diagnostic_too_deep, self->budget->depth);
+	return false;
+}
+
+static void parser_exhaust(struct parser *self, enum diagnostic_code code, size_t limit)
+{
+	self->exhausted = true;
+	self->diagnostic = diagnostic_create(code, self->lookahead.span);
+	self->diagnostic.got = token_create_number(value_create_integer(limit));
 }
 
 static bool parser_expect(struct parser *self, enum token_type t)
 {
-	if (self->lookahead.error)
-		return false;
 	if (self->lookahead.type != t)
 		return false;
 
@@ -97,17 +220,18 @@ static bool parser_expect(struct parser *self, enum token_type t)
 
 static bool parser_expect_peek(struct parser *self, enum token_type t)
 {
-	return self->lookahead.error == NULL && self->lookahead.type == t;
+	return self->lookahead.type == t;
 }
 
 struct parser_result parser_parse(struct parser *self)
 {
-	struct parser_result result = parser_program(self);
+	struct parser_result result = self->interpreter ? parser_run(self)
+							: parser_program(self);
 	if (result.error)
 		return result;
 
 	if (!parser_expect(self, token_end)) {
-		free(result.ast);
+		ast_destroy(result.ast);
 		return parser_error_type(self, token_end);
 	}
 
@@ -117,30 +241,108 @@ struct parser_result parser_parse(struct parser *self)
 static struct parser_result parser_program(struct parser *self)
 {
 	struct ast *a = ast_create(ast_program);
+	a->span = self->lookahead.span;
 
 	while (self->lookahead.type != token_end) {
 		struct parser_result stmt = parser_statement(self);
 		if (stmt.error) {
-			ast_destroy(a);
-			return stmt;
+			parser_recover(self, 0);
+			if (self->exhausted)
+				break;
+			continue;
 		}
 
 		ast_add_child(a, stmt.ast);
 	}
 
+	if (self->diagnostics.nelts > 0) {
+		ast_destroy(a);
+		return (struct parser_result) {
+			.error = &self->diagnostics.elts[0]
+		};
+	}
+
 	return parser_result_create(a);
 }
 
+/* Direct evaluation cannot recover: the statements before the error have run. */
+static struct parser_result parser_run(struct parser *self)
+{
+	interpreter_begin(self->interpreter);
+
+	while (self->lookahead.type != token_end) {
+		struct parser_result stmt = parser_statement(self);
+		if (stmt.error)
+			return stmt;
+	}
+
+	return parser_result_create(NULL);
+}
+
+/* Runs a statement that direct evaluation has just read. */
+static struct parser_result parser_execute(struct parser *self, struct parser_result statement,
+					  struct span span)
+{
+	struct interpreter *i = self->interpreter;
+	i->error = NULL;
+
+	if (statement.ast) {
+		interpreter_statement(i, statement.ast);
+		ast_destroy(statement.ast);
+	} else if (!self->failed && interpreter_spend(i, span)) {
+		if (self->target)
+			interpreter_set(i, self->target, statement.value);
+		else
+			value_print(statement.value, i->output);
+	}
+
+	if (!self->failed && i->error) {
+		self->failed = true;
+		self->diagnostic = *i->error;
+	}
+
+	if (self->failed)
+		return parser_result_create_error(self);
+	return parser_result_create(NULL);
+}
+
+/* Keeps the first runtime error of a statement in direct evaluation. */
+static void parser_fail(struct parser *self, enum diagnostic_code code, struct span span)
+{
+	if (self->failed)
+		return;
+
+	self->failed = true;
+	self->diagnostic = diagnostic_create(code, span);
+}
+
 static struct parser_result parser_statement(struct parser *self)
 {
 	struct parser_result result;
+	struct interpreter *i = self->interpreter;
+	struct span span = self->lookahead.span;
+
+	self->target = NULL;
 
-	if (self->lookahead.type == token_laat)
+	if (self->lookahead.type == token_laat) {
 		result = parser_assign(self);
-	else if (self->lookahead.type == token_print)
+	} else if (self->lookahead.type == token_print) {
 		result = parser_print(self);
-	else
-		return parser_error(self, "assignment or print");
+	} else if (self->lookahead.type == token_herhaal) {
+		self->interpreter = NULL;
+		result = parser_repeat(self);
+		self->interpreter = i;
+
+		/* The body recovers from its errors, which must not run either. */
+		if (i && !result.error && self->diagnostics.nelts > 0) {
+			ast_destroy(result.ast);
+			return (struct parser_result) {
+				.error = &self->diagnostics.elts[0]
+			};
+		}
+	} else {
+		return parser_error(self, "assignment, print or herhaal");
+	}
 
 	if (result.error)
 		return result;
@@ -150,25 +352,43 @@ static struct parser_result parser_statement(struct parser *self)
 		return parser_error_type(self, token_semicolon);
 	}
 
+	if (i)
+		return parser_execute(self, result, span);
 	return result;
 }
 
 static struct parser_result parser_assign(struct parser *self)
 {
+	struct span span = self->lookahead.span;
+
+	if (!parser_spend(self, 2))
+		return parser_result_create_error(self);
 	if (!parser_expect(self, token_laat))
 		return parser_error_type(self, token_laat);
 
-	if (self->lookahead.error)
-		return parser_error_lookahead(self);
-
-	struct ast *assignee;
-	if (self->lookahead.type == token_name)
-		assignee = ast_create_name(strdup(self->lookahead.name_value));
-	else if (self->lookahead.type == token_het)
+	struct interpreter *i = self->interpreter;
+	struct token t = self->lookahead;
+	struct ast *assignee = NULL;
+
+	if (t.type == token_name && i) {
+		memcpy(self->name, t.name_value, t.name_length);
+		self->name[t.name_length] = '\0';
+		self->target = self->name;
+	} else if (t.type == token_name) {
+		assignee = ast_create_name(strndup(t.name_value, t.name_length));
+	} else if (t.type == token_het && i) {
+		if (i->last_var >= 0)
+			self->target = i->variables.elts[i->last_var].name;
+		else
+			parser_fail(self, diagnostic_invalid_het, t.span);
+	} else if (t.type == token_het) {
 		assignee = ast_create(ast_het);
-	else
+	} else {
 		return parser_error(self, "name or het");
+	}
 
+	if (assignee)
+		assignee->span = t.span;
 	parser_consume(self);
 
 	struct parser_result expr = parser_expression(self, 0);
@@ -183,7 +403,11 @@ static struct parser_result parser_assign(struct parser *self)
 		return parser_error_type(self, token_zijn);
 	}
 
+	if (i)
+		return expr;
+
 	struct ast *ast = ast_create(ast_assign);
+	ast->span = span;
 	ast_add_child(ast, assignee);
 	ast_add_child(ast, expr.ast);
 
@@ -192,6 +416,10 @@ static struct parser_result parser_assign(struct parser *self)
 
 static struct parser_result parser_print(struct parser *self)
 {
+	struct span span = self->lookahead.span;
+
+	if (!parser_spend(self, 1))
+		return parser_result_create_error(self);
 	if (!parser_expect(self, token_print))
 		return parser_error_type(self, token_print);
 
@@ -199,15 +427,76 @@ static struct parser_result parser_print(struct parser *self)
 	if (expr.error)
 		return expr;
 
-	if (!parser_expect(self, token_uit))
+	if (!parser_expect(self, token_uit)) {
+		ast_destroy(expr.ast);
 		return parser_error_type(self, token_uit);
+	}
+
+	if (self->interpreter)
+		return expr;
 
 	struct ast *ast = ast_create(ast_print);
+	ast->span = span;
 	ast_add_child(ast, expr.ast);
 
 	return parser_result_create(ast);
 }
 
+/* The body is parsed like a program, up to the klaar that ends it. */
+static struct parser_result parser_repeat(struct parser *self)
+{
+	struct span span = self->lookahead.span;
+
+	if (!parser_spend(self, 2))
+		return parser_result_create_error(self);
+	if (!parser_expect(self, token_herhaal))
+		return parser_error_type(self, token_herhaal);
+
+	int depth = ++self->depth;
+	if (!parser_nest(self, 0))
+		return parser_result_create_error(self);
+
+	struct parser_result count = parser_expression(self, 0);
+	if (count.error)
+		return count;
+
+	if (!parser_expect(self, token_keer)) {
+		ast_destroy(count.ast);
+		return parser_error_type(self, token_keer);
+	}
+
+	struct ast *body = ast_create(ast_program);
+	body->span = self->lookahead.span;
+
+	while (self->lookahead.type != token_klaar && self->lookahead.type != token_end) {
+		struct parser_result stmt = parser_statement(self);
+		if (stmt.error && self->exhausted) {
+			ast_destroy(count.ast);
+			ast_destroy(body);
+			return stmt;
+		} else if (stmt.error) {
+			parser_recover(self, depth);
+			continue;
+		}
+
+		ast_add_child(body, stmt.ast);
+	}
+
+	if (!parser_expect(self, token_klaar)) {
+		ast_destroy(count.ast);
+		ast_destroy(body);
+		return parser_error_type(self, token_klaar);
+	}
+	self->depth--;
+
+	struct ast *ast = ast_create(ast_repeat);
+	ast->span = span;
+	ast_add_child(ast, count.ast);
+	ast_add_child(ast, body);
+
+	return parser_result_create(ast);
+}
+
 static struct infix_bp get_infix_bp(enum token_type t)
 {
 	switch (t) {
@@ -224,30 +513,39 @@ static struct infix_bp get_infix_bp(enum token_type t)
 
 static struct parser_result parser_primary(struct parser *self)
 {
+	if (self->lookahead.type == token_lparen ? !parser_nest(self, 1) : !parser_spend(self, 1))
+		return parser_result_create_error(self);
+
+	if (self->interpreter)
+		return parser_primary_value(self);
+
 	struct ast *prim;
-	if (self->lookahead.error)
-		return parser_error_lookahead(self);
 
 	switch (self->lookahead.type) {
 	case token_number:
 		prim = ast_create_number(self->lookahead.number_value);
 		break;
 	case token_name:
-		prim = ast_create_name(strdup(self->lookahead.name_value));
+		prim = ast_create_name(strndup(self->lookahead.name_value,
+					       self->lookahead.name_length));
 		break;
 	case token_het:
 		prim = ast_create(ast_het);
 		break;
 	case token_lparen: {
 		parser_consume(self);
+		self->parens++;
 		struct parser_result l = parser_expression(self, 0);
+		self->parens--;
 		if (l.error)
 			return l;
 
 		prim = l.ast;
 
-		if (!parser_expect_peek(self, token_rparen))
+		if (!parser_expect_peek(self, token_rparen)) {
+			ast_destroy(prim);
 			return parser_error_type(self, token_rparen);
+		}
 
 		break;
 	}
@@ -255,18 +553,85 @@ static struct parser_result parser_primary(struct parser *self)
 		return parser_error(self, "number, name, het, or (");
 	}
 
+	if (self->lookahead.type != token_rparen)
+		prim->span = self->lookahead.span;
+
 	parser_consume(self);
 
 	return parser_result_create(prim);
 }
 
+/*
+ * Direct evaluation reads names and het as the interpreter would, but keeps
+ * going after a runtime error, so a syntax error later in the statement is
+ * still the one reported.
+ */
+static struct parser_result parser_primary_value(struct parser *self)
+{
+	struct interpreter *i = self->interpreter;
+	struct token t = self->lookahead;
+	struct parser_result result = { 0 };
+
+	switch (t.type) {
+	case token_number:
+		result.value = t.number_value;
+		break;
+	case token_name: {
+		char name[MAX_NAME_LENGTH + 1];
+		memcpy(name, t.name_value, t.name_length);
+		name[t.name_length] = '\0';
+
+		int var = interpreter_lookup(i, name);
+		if (var >= 0) {
+			result.value = interpreter_get(i, var);
+		} else if (!self->failed) {
+			parser_fail(self, diagnostic_undefined_variable, t.span);
+			diagnostic_set_text(&self->diagnostic, name, t.name_length);
+		}
+		break;
+	}
+	case token_het:
+		if (i->last_var >= 0)
+			result.value = interpreter_get(i, i->last_var);
+		else
+			parser_fail(self, diagnostic_invalid_het, t.span);
+		break;
+	case token_lparen:
+		parser_consume(self);
+		self->parens++;
+		result = parser_expression(self, 0);
+		self->parens--;
+		if (result.error)
+			return result;
+
+		if (!parser_expect_peek(self, token_rparen))
+			return parser_error_type(self, token_rparen);
+		break;
+	default:
+		return parser_error(self, "number, name, het, or (");
+	}
+
+	parser_consume(self);
+	return result;
+}
+
+static struct value parser_apply(enum token_type op, struct value left, struct value right)
+{
+	switch (op) {
+	case token_plus: return value_add(left, right);
+	case token_minus: return value_subtract(left, right);
+	case token_star: return value_multiply(left, right);
+	case token_slash: return value_divide(left, right);
+	default: assert(false);
+	}
+}
+
 static struct parser_result parser_expression(struct parser *self,
 						    int min_bp)
 {
-	if (self->lookahead.error)
-		return parser_error_lookahead(self);
-
 	struct parser_result lhs = parser_primary(self);
+	if (lhs.error)
+		return lhs;
 
 	for (;;) {
 		struct infix_bp bp = get_infix_bp(self->lookahead.type);
@@ -274,6 +639,26 @@ static struct parser_result parser_expression(struct parser *self,
 		if (bp.left < min_bp)
 			break;
 
+		if (!parser_spend(self, 1)) {
+			ast_destroy(lhs.ast);
+			return parser_result_create_error(self);
+		}
+
+		if (self->interpreter) {
+			enum token_type op = self->lookahead.type;
+			parser_consume(self);
+
+			struct parser_result rhs = parser_expression(self, bp.right);
+			if (rhs.error)
+				return rhs;
+
+			lhs.value = parser_apply(op, lhs.value, rhs.value);
+			lhs.height = 1 + (lhs.height > rhs.height ? lhs.height : rhs.height);
+			if (!parser_nest(self, lhs.height))
+				return parser_result_create_error(self);
+			continue;
+		}
+
 		struct ast *op;
 		if (self->lookahead.type == token_plus)
 			op = ast_create(ast_plus);
@@ -286,10 +671,12 @@ static struct parser_result parser_expression(struct parser *self,
 		else
 			assert(false);
 
+		op->span = self->lookahead.span;
 		parser_consume(self);
 
 		struct parser_result rhs = parser_expression(self, bp.right);
 		if (rhs.error) {
+			ast_destroy(op);
 			ast_destroy(lhs.ast);
 			return rhs;
 		}
@@ -298,6 +685,11 @@ static struct parser_result parser_expression(struct parser *self,
 		ast_add_child(op, rhs.ast);
 
 		lhs.ast = op;
+		lhs.height = 1 + (lhs.height > rhs.height ? lhs.height : rhs.height);
+		if (!parser_nest(self, lhs.height)) {
+			ast_destroy(op);
+			return parser_result_create_error(self);
+		}
 	}
 
 	return lhs;
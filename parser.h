@@ -1,18 +1,65 @@
 #pragma once
 
 #include "ast.h"
+#include "budget.h"
+#include "diagnostic.h"
 #include "lexer.h"
+#include "stream.h"
 
+array_declare(struct diagnostic, diagnostic)
+
+struct interpreter;
+
+/*
+ * The parser recovers from a syntax error by skipping to the next semicolon
+ * at the same depth of repeats, so one pass finds every error. They are kept
+ * in diagnostics in source order. A parser made with parser_create_stream
+ * reads a pretokenized stream instead of running the lexer.
+ *
+ * A parser made with parser_create_direct builds no tree: expressions are
+ * computed as they are read, and each statement runs on the interpreter as
+ * soon as its semicolon is. Only a repeat, whose body runs more than once,
+ * is still built and handed to interpreter_statement. It stops at the first
+ * error, syntax or runtime; the statements before it have run already.
+ *
+ * With a budget set, running out of nodes or depth ends the parse with that
+ * error, without recovering. A direct parser takes the interpreter's budget.
+ */
 struct parser {
 	struct lexer input;
+	struct stream const *stream;
+	struct stream_cursor cursor;
 	struct token lookahead;
+	struct diagnostic diagnostic;
+	struct array_diagnostic diagnostics;
+	int depth;
+	struct interpreter *interpreter;
+	/* The variable the statement assigns, or NULL when it prints. */
+	char const *target;
+	char name[MAX_NAME_LENGTH + 1];
+	/* A runtime error is kept in diagnostic until the statement is read. */
+	bool failed;
+	struct budget const *budget;
+	size_t nodes;
+	size_t parens;
+	bool exhausted;
 };
 
+/*
+ * On failure, error points at the first diagnostic and ast is NULL. In
+ * direct evaluation ast is always NULL, and an expression gives its value.
+ * The height of an expression is how many operators it chains.
+ */
 struct parser_result {
 	struct ast *ast;
-	char *error;
+	struct diagnostic const *error;
+	struct value value;
+	size_t height;
 };
 
 struct parser parser_create(char *input);
+struct parser parser_create_range(char *input, struct span start, int end);
+struct parser parser_create_stream(struct stream const *stream);
+struct parser parser_create_direct(char *input, struct interpreter *i);
 void parser_destroy(struct parser *p);
 struct parser_result parser_parse(struct parser *p);
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+
+#include "profile.h"
+#include "hash.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+array_create_declare(struct profile_entry, profile_entry)
+array_destroy_declare(struct profile_entry, profile_entry)
+array_push_declare(struct profile_entry, profile_entry)
+
+array_destroy_declare(uint64_t, u64)
+array_push_declare(uint64_t, u64)
+
+struct profile_read {
+	uint64_t count;
+	size_t var;
+};
+
+static void profile_index_insert(struct profile *self, size_t entry);
+static uint64_t profile_hash(struct span span);
+static void profile_frames(struct profile *self, size_t entry, FILE *f);
+static int by_time(void const *a, void const *b);
+static int by_reads(void const *a, void const *b);
+
+struct profile profile_create(void)
+{
+	return (struct profile) {
+		.entries = array_create_profile_entry()
+	};
+}
+
+void profile_destroy(struct profile *self)
+{
+	array_destroy_profile_entry(self->entries);
+	array_destroy_u64(self->variables);
+	free(self->index);
+}
+
+/* The entry for the statement's position, created on its first run. */
+struct profile_entry *profile_entry(struct profile *self, struct ast *statement)
+{
+	struct span span = statement->span;
+
+	if (self->index_size > 0) {
+		size_t mask = self->index_size - 1;
+		for (size_t i = profile_hash(span) & mask; self->index[i]; i = (i + 1) & mask) {
+			struct profile_entry *e = &self->entries.elts[self->index[i] - 1];
+			if (e->span.line == span.line && e->span.column == span.column)
+				return e;
+		}
+	}
+
+	struct profile_entry *e = array_push_profile_entry(&self->entries);
+	*e = (struct profile_entry) {
+		.span = span,
+		.parent = self->current
+	};
+
+	struct ast *assignee = statement->children.elts[0];
+	if (statement->type == ast_print)
+		strcpy(e->label, "print");
+	else if (statement->type == ast_repeat)
+		strcpy(e->label, "herhaal");
+	else if (assignee->type == ast_het)
+		strcpy(e->label, "laat het");
+	else
+		snprintf(e->label, sizeof(e->label), "laat %s", assignee->name_value);
+
+	profile_index_insert(self, self->entries.nelts - 1);
+	return &self->entries.elts[self->entries.nelts - 1];
+}
+
+void profile_variable(struct profile *self, size_t var)
+{
+	while (self->variables.nelts <= var)
+		*array_push_u64(&self->variables) = 0;
+
+	self->variables.elts[var]++;
+}
+
+void profile_report(struct profile *self, struct interpreter const *i, char const *name,
+		    FILE *f)
+{
+	size_t n = self->entries.nelts;
+	struct profile_entry *sorted = malloc(sizeof(struct profile_entry) * (n ? n : 1));
+	memcpy(sorted, self->entries.elts, sizeof(struct profile_entry) * n);
+	qsort(sorted, n, sizeof(struct profile_entry), by_time);
+
+	fprintf(f, "%12s %10s %12s %12s  %s\n", "time (ms)", "count", "ops", "lookups",
+		"statement");
+	for (size_t e = 0; e < n; e++) {
+		fprintf(f, "%12.3f %10" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %s:%d:%d %s\n",
+			sorted[e].ns / 1e6, sorted[e].count, sorted[e].ops, sorted[e].lookups,
+			name, sorted[e].span.line, sorted[e].span.column, sorted[e].label);
+	}
+	free(sorted);
+
+	size_t nvars = 0;
+	struct profile_read *reads = malloc(sizeof(struct profile_read) *
+					    (self->variables.nelts ? self->variables.nelts : 1));
+	for (size_t v = 0; v < self->variables.nelts; v++) {
+		if (self->variables.elts[v] > 0)
+			reads[nvars++] = (struct profile_read) { self->variables.elts[v], v };
+	}
+	qsort(reads, nvars, sizeof(struct profile_read), by_reads);
+
+	fprintf(f, "\n%12s  %s\n", "lookups", "variable");
+	for (size_t v = 0; v < nvars; v++)
+		fprintf(f, "%12" PRIu64 "  %s\n", reads[v].count,
+			i->variables.elts[reads[v].var].name);
+	free(reads);
+}
+
+void profile_collapsed(struct profile *self, char const *name, FILE *f)
+{
+	size_t n = self->entries.nelts;
+	uint64_t *nested = calloc(n ? n : 1, sizeof(uint64_t));
+
+	for (size_t e = 0; e < n; e++) {
+		struct profile_entry *entry = &self->entries.elts[e];
+		if (entry->parent)
+			nested[entry->parent - 1] += entry->ns;
+	}
+
+	for (size_t e = 0; e < n; e++) {
+		fputs(name, f);
+		profile_frames(self, e, f);
+		fprintf(f, " %" PRIu64 "\n", self->entries.elts[e].ns - nested[e]);
+	}
+
+	free(nested);
+}
+
+static void profile_frames(struct profile *self, size_t entry, FILE *f)
+{
+	struct profile_entry *e = &self->entries.elts[entry];
+	if (e->parent)
+		profile_frames(self, e->parent - 1, f);
+
+	fprintf(f, ";%d:%d %s", e->span.line, e->span.column, e->label);
+}
+
+static void profile_index_insert(struct profile *self, size_t entry)
+{
+	if ((entry + 1) * 2 > self->index_size) {
+		size_t size = self->index_size ? self->index_size * 2 : 64;
+		free(self->index);
+		self->index = calloc(size, sizeof(size_t));
+		self->index_size = size;
+
+		for (size_t e = 0; e < entry; e++)
+			profile_index_insert(self, e);
+	}
+
+	size_t mask = self->index_size - 1;
+	size_t i = profile_hash(self->entries.elts[entry].span) & mask;
+	while (self->index[i])
+		i = (i + 1) & mask;
+
+	self->index[i] = entry + 1;
+}
+
+static uint64_t profile_hash(struct span span)
+{
+	int key[2] = { span.line, span.column };
+	return hash_bytes((char const *)key, sizeof(key));
+}
+
+static int by_time(void const *a, void const *b)
+{
+	struct profile_entry const *x = a, *y = b;
+	return (x->ns < y->ns) - (x->ns > y->ns);
+}
+
+static int by_reads(void const *a, void const *b)
+{
+	struct profile_read const *x = a, *y = b;
+	return (x->count < y->count) - (x->count > y->count);
+}
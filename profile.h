@@ -0,0 +1,53 @@
+#pragma once
+
+#include "array.h"
+#include "interpreter.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * What an interpreter spent on each statement of a program, keyed by the
+ * line and column the statement starts at, and how often it read each
+ * variable. Set interpreter.profile to collect; counting only happens then.
+ * The costs of a repeat include those of its body, whose statements have the
+ * repeat as their parent.
+ */
+
+struct profile_entry {
+	struct span span;
+	char label[MAX_NAME_LENGTH + 6];
+	/* The enclosing repeat's entry plus one, or zero. */
+	size_t parent;
+	uint64_t count;
+	uint64_t ns;
+	uint64_t ops;
+	uint64_t lookups;
+};
+
+array_declare(struct profile_entry, profile_entry)
+array_declare(uint64_t, u64)
+
+struct profile {
+	struct array_profile_entry entries;
+	size_t *index;
+	size_t index_size;
+	struct array_u64 variables;
+	uint64_t ops;
+	uint64_t lookups;
+	/* The entry of the repeat whose body is running plus one, or zero. */
+	size_t current;
+};
+
+struct profile profile_create(void);
+void profile_destroy(struct profile *p);
+struct profile_entry *profile_entry(struct profile *p, struct ast *statement);
+void profile_variable(struct profile *p, size_t var);
+/* Statements by time spent, then variables by number of reads. */
+void profile_report(struct profile *p, struct interpreter const *i, char const *name,
+		    FILE *f);
+/*
+ * One "name;line:column label nanoseconds" line per statement, for flame
+ * graphs. The statements in a repeat are frames on top of it, and every line
+ * counts only the time spent in that frame itself.
+ */
+void profile_collapsed(struct profile *p, char const *name, FILE *f);
@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+
+#include "schedule.h"
+#include "hash.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct schedule_thresholds schedule_thresholds = {
+	.min_statements = 4096,
+	.batch = 64,
+	.min_batches = 4
+};
+
+#define NO_STATEMENT SIZE_MAX
+
+/* Where the value of a name or "het" comes from. */
+struct input {
+	bool from_statement;
+	union {
+		size_t statement;
+		struct value value;
+	};
+};
+
+array_declare(struct input, input)
+array_create_declare(struct input, input)
+array_destroy_declare(struct input, input)
+array_push_declare(struct input, input)
+
+struct statement {
+	struct ast *ast;
+	char const *target;
+	size_t input;
+	size_t level;
+	struct value result;
+};
+
+struct definition {
+	char const *name;
+	size_t statement;
+};
+
+struct schedule {
+	struct interpreter *interpreter;
+	struct statement *statements;
+	size_t nstatements;
+	struct array_input inputs;
+	struct definition *definitions;
+	size_t definitions_size;
+	size_t ndefinitions;
+	size_t last;
+	bool failed;
+	struct diagnostic error;
+	size_t *order;
+	size_t *waves;
+	size_t nwaves;
+	atomic_size_t next;
+	pthread_mutex_t start;
+	pthread_barrier_t barrier;
+};
+
+static void schedule_segment(struct interpreter *i, struct ast **statements, size_t n,
+			     size_t nthreads);
+static bool schedule_analyze(struct schedule *self, size_t k);
+static bool schedule_inputs(struct schedule *self, struct ast *ast, size_t *level);
+static void schedule_fail(struct schedule *self, enum diagnostic_code code, struct ast *ast);
+static size_t schedule_definition(struct schedule *self, char const *name);
+static void schedule_define(struct schedule *self, char const *name, size_t k);
+static void schedule_waves(struct schedule *self);
+static void schedule_run(struct schedule *self, size_t nthreads);
+static void *schedule_worker(void *arg);
+static void schedule_evaluate(struct schedule *self, size_t k);
+static struct value schedule_expression(struct schedule *self, struct ast *ast, size_t *input);
+
+void schedule_interpret(struct interpreter *i, struct ast *program, size_t nthreads)
+{
+	struct ast **statements = program->children.elts;
+	size_t n = program->children.nelts;
+
+	/* A budget counts statements in order, which waves do not keep. */
+	if (i->budget) {
+		interpreter_interpret(i, program);
+		return;
+	}
+
+	if (nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	i->error = NULL;
+
+	for (size_t begin = 0; begin < n && !i->error;) {
+		size_t end = begin;
+		while (end < n && statements[end]->type != ast_repeat)
+			end++;
+
+		if (end > begin)
+			schedule_segment(i, &statements[begin], end - begin, nthreads);
+		if (end < n && !i->error)
+			interpreter_statement(i, statements[end]);
+
+		begin = end + 1;
+	}
+}
+
+static void schedule_segment(struct interpreter *i, struct ast **statements, size_t n,
+			     size_t nthreads)
+{
+	struct schedule self = {
+		.interpreter = i,
+		.statements = calloc(n + 1, sizeof(struct statement)),
+		.inputs = array_create_input(),
+		.last = NO_STATEMENT,
+		.start = PTHREAD_MUTEX_INITIALIZER
+	};
+
+	/* Only the statements before the first failing one ever run. */
+	while (self.nstatements < n) {
+		struct statement *s = &self.statements[self.nstatements];
+		s->ast = statements[self.nstatements];
+		if (!schedule_analyze(&self, self.nstatements))
+			break;
+		if (s->level + 1 > self.nwaves)
+			self.nwaves = s->level + 1;
+		self.nstatements++;
+	}
+
+	/* A chain of dependencies makes narrow waves, which are run in order. */
+	struct schedule_thresholds const *t = &schedule_thresholds;
+	if (nthreads > 1 && self.nstatements >= t->min_statements &&
+	    self.nstatements / self.nwaves >= t->min_batches * t->batch * nthreads) {
+		schedule_waves(&self);
+		schedule_run(&self, nthreads);
+	} else {
+		for (size_t k = 0; k < self.nstatements; k++)
+			schedule_evaluate(&self, k);
+	}
+
+	for (size_t k = 0; k < self.nstatements; k++) {
+		struct statement *s = &self.statements[k];
+		if (s->target)
+			interpreter_set(i, s->target, s->result);
+		else
+			value_print(s->result, i->output);
+	}
+
+	if (self.failed) {
+		i->diagnostic = self.error;
+		i->error = &i->diagnostic;
+	}
+
+	free(self.order);
+	free(self.waves);
+	free(self.definitions);
+	array_destroy_input(self.inputs);
+	free(self.statements);
+}
+
+/*
+ * Binds the names statement k reads and finds its wave, which is one past the
+ * latest wave it reads from. Returns false if the statement would fail.
+ */
+static bool schedule_analyze(struct schedule *self, size_t k)
+{
+	struct interpreter *i = self->interpreter;
+	struct statement *s = &self->statements[k];
+	struct ast *ast = s->ast;
+
+	s->input = self->inputs.nelts;
+
+	if (ast->type == ast_print)
+		return schedule_inputs(self, ast->children.elts[0], &s->level);
+
+	assert(ast->type == ast_assign);
+
+	struct ast *assignee = ast->children.elts[0];
+	if (assignee->type == ast_name) {
+		s->target = assignee->name_value;
+	} else if (self->last != NO_STATEMENT) {
+		s->target = self->statements[self->last].target;
+	} else if (i->last_var >= 0) {
+		s->target = i->variables.elts[i->last_var].name;
+	} else {
+		schedule_fail(self, diagnostic_invalid_het, assignee);
+		return false;
+	}
+
+	if (!schedule_inputs(self, ast->children.elts[1], &s->level))
+		return false;
+
+	schedule_define(self, s->target, k);
+	self->last = k;
+	return true;
+}
+
+static bool schedule_inputs(struct schedule *self, struct ast *ast, size_t *level)
+{
+	struct interpreter *i = self->interpreter;
+	size_t from = NO_STATEMENT;
+	int var = -1;
+
+	switch (ast->type) {
+	case ast_number:
+		return true;
+	case ast_name:
+		from = schedule_definition(self, ast->name_value);
+		if (from == NO_STATEMENT)
+			var = interpreter_lookup(i, ast->name_value);
+		if (from == NO_STATEMENT && var < 0) {
+			schedule_fail(self, diagnostic_undefined_variable, ast);
+			return false;
+		}
+		break;
+	case ast_het:
+		from = self->last;
+		var = i->last_var;
+		if (from == NO_STATEMENT && var < 0) {
+			schedule_fail(self, diagnostic_invalid_het, ast);
+			return false;
+		}
+		break;
+	default:
+		return schedule_inputs(self, ast->children.elts[0], level) &&
+		       schedule_inputs(self, ast->children.elts[1], level);
+	}
+
+	struct input *in = array_push_input(&self->inputs);
+	if (from != NO_STATEMENT) {
+		*in = (struct input) { .from_statement = true, .statement = from };
+		if (self->statements[from].level + 1 > *level)
+			*level = self->statements[from].level + 1;
+	} else {
+		*in = (struct input) { .value = i->variables.elts[var].value };
+	}
+
+	return true;
+}
+
+static void schedule_fail(struct schedule *self, enum diagnostic_code code, struct ast *ast)
+{
+	self->failed = true;
+	self->error = diagnostic_create(code, ast->span);
+	if (code == diagnostic_undefined_variable)
+		diagnostic_set_text(&self->error, ast->name_value, strlen(ast->name_value));
+}
+
+static size_t schedule_definition(struct schedule *self, char const *name)
+{
+	if (self->definitions_size == 0)
+		return NO_STATEMENT;
+
+	size_t mask = self->definitions_size - 1;
+	for (size_t i = hash_string(name) & mask; self->definitions[i].name;
+	     i = (i + 1) & mask) {
+		if (strcmp(self->definitions[i].name, name) == 0)
+			return self->definitions[i].statement;
+	}
+
+	return NO_STATEMENT;
+}
+
+static void schedule_define(struct schedule *self, char const *name, size_t k)
+{
+	if ((self->ndefinitions + 1) * 2 > self->definitions_size) {
+		struct definition *old = self->definitions;
+		size_t old_size = self->definitions_size;
+
+		self->definitions_size = old_size ? old_size * 2 : 64;
+		self->definitions = calloc(self->definitions_size, sizeof(struct definition));
+		self->ndefinitions = 0;
+
+		for (size_t i = 0; i < old_size; i++) {
+			if (old[i].name)
+				schedule_define(self, old[i].name, old[i].statement);
+		}
+
+		free(old);
+	}
+
+	size_t mask = self->definitions_size - 1;
+	size_t i = hash_string(name) & mask;
+	while (self->definitions[i].name && strcmp(self->definitions[i].name, name) != 0)
+		i = (i + 1) & mask;
+
+	if (self->definitions[i].name == NULL)
+		self->ndefinitions++;
+
+	self->definitions[i] = (struct definition) { name, k };
+}
+
+/* Sorts the statements by wave; wave w is order[waves[w]] up to waves[w + 1]. */
+static void schedule_waves(struct schedule *self)
+{
+	size_t n = self->nstatements;
+
+	self->waves = calloc(self->nwaves + 1, sizeof(size_t));
+	self->order = malloc(sizeof(size_t) * n);
+
+	for (size_t k = 0; k < n; k++)
+		self->waves[self->statements[k].level + 1]++;
+	for (size_t w = 0; w < self->nwaves; w++)
+		self->waves[w + 1] += self->waves[w];
+
+	size_t *fill = malloc(sizeof(size_t) * (self->nwaves + 1));
+	memcpy(fill, self->waves, sizeof(size_t) * (self->nwaves + 1));
+	for (size_t k = 0; k < n; k++)
+		self->order[fill[self->statements[k].level]++] = k;
+	free(fill);
+}
+
+static void schedule_run(struct schedule *self, size_t nthreads)
+{
+	pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+	size_t started = 1;
+
+	atomic_store(&self->next, 0);
+
+	/* The workers wait for the lock, so the barrier can count those that started. */
+	pthread_mutex_lock(&self->start);
+	for (; started < nthreads; started++) {
+		if (pthread_create(&threads[started], NULL, schedule_worker, self) != 0)
+			break;
+	}
+	pthread_barrier_init(&self->barrier, NULL, started);
+	pthread_mutex_unlock(&self->start);
+
+	schedule_worker(self);
+	for (size_t t = 1; t < started; t++)
+		pthread_join(threads[t], NULL);
+
+	pthread_barrier_destroy(&self->barrier);
+	free(threads);
+}
+
+/*
+ * Every thread runs the waves in lockstep. The barriers make sure a wave only
+ * starts once the previous one has been fully evaluated.
+ */
+static void *schedule_worker(void *arg)
+{
+	struct schedule *self = arg;
+	size_t batch = schedule_thresholds.batch;
+
+	pthread_mutex_lock(&self->start);
+	pthread_mutex_unlock(&self->start);
+
+	for (size_t w = 0; w < self->nwaves; w++) {
+		pthread_barrier_wait(&self->barrier);
+
+		size_t end = self->waves[w + 1];
+		size_t k;
+		while ((k = atomic_fetch_add(&self->next, batch)) < end) {
+			size_t stop = k + batch < end ? k + batch : end;
+			for (; k < stop; k++)
+				schedule_evaluate(self, self->order[k]);
+		}
+
+		if (pthread_barrier_wait(&self->barrier) == PTHREAD_BARRIER_SERIAL_THREAD)
+			atomic_store(&self->next, end);
+	}
+
+	return NULL;
+}
+
+static void schedule_evaluate(struct schedule *self, size_t k)
+{
+	struct statement *s = &self->statements[k];
+	size_t input = s->input;
+
+	s->result = schedule_expression(self, s->ast->children.elts[s->ast->children.nelts - 1],
+					&input);
+}
+
+static struct value schedule_expression(struct schedule *self, struct ast *ast, size_t *input)
+{
+	switch (ast->type) {
+	case ast_number:
+		return ast->number_value;
+	case ast_name:
+	case ast_het: {
+		struct input in = self->inputs.elts[(*input)++];
+		return in.from_statement ? self->statements[in.statement].result : in.value;
+	}
+	default:
+		break;
+	}
+
+	struct value left = schedule_expression(self, ast->children.elts[0], input);
+	struct value right = schedule_expression(self, ast->children.elts[1], input);
+
+	switch (ast->type) {
+	case ast_plus: return value_add(left, right);
+	case ast_minus: return value_subtract(left, right);
+	case ast_star: return value_multiply(left, right);
+	case ast_slash: return value_divide(left, right);
+	default: assert(false);
+	}
+}
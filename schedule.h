@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ast.h"
+#include "interpreter.h"
+
+/*
+ * Runs a program like interpreter_interpret, but evaluates independent
+ * statements on several threads.
+ *
+ * Every name a statement reads is first bound to the earlier statement in the
+ * program that assigned it, or to its current value in the interpreter. "het"
+ * binds to the previous assignment the same way. A statement only depends on
+ * the statements it reads from, so statements are evaluated in waves of
+ * mutually independent ones. Results are committed afterwards in program
+ * order, which keeps the output order, the variables and the error the same
+ * as sequential execution.
+ *
+ * The statements between two repeats are scheduled this way one stretch at a
+ * time. The rounds of a repeat depend on each other, so the interpreter runs
+ * the repeat itself in between.
+ */
+void schedule_interpret(struct interpreter *i, struct ast *program, size_t nthreads);
+
+/*
+ * When the threads are used. The defaults are tuned for speed; the fuzzer
+ * lowers them so that its small programs take the threaded path as well.
+ */
+struct schedule_thresholds {
+	/* Below this many statements threads cost more than they save. */
+	size_t min_statements;
+	/* Statements a thread takes from a wave at a time. */
+	size_t batch;
+	/*
+	 * Every wave costs each thread two barriers, so threads only pay off if
+	 * the waves hold at least this many batches per thread on average.
+	 */
+	size_t min_batches;
+};
+
+extern struct schedule_thresholds schedule_thresholds;
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "interpreter.h"
+#include "parser.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 64
+
+struct server_session {
+	int fd;
+	struct interpreter interpreter;
+	char *in;
+	size_t in_length;
+	size_t in_size;
+	char *out;
+	size_t out_length;
+	size_t out_sent;
+	uint32_t events;
+	bool busy;
+	bool eof;
+	bool dead;
+	bool closed;
+	struct server_session *prev;
+	struct server_session *next;
+};
+
+/* Complete lines of one session, and the responses to them once evaluated. */
+struct server_job {
+	struct server_session *session;
+	char *input;
+	size_t length;
+	char *output;
+	size_t output_length;
+	struct server_job *next;
+};
+
+static void server_accept(struct server *self);
+static void server_finish(struct server *self);
+static void server_read(struct server_session *session);
+static void server_write(struct server_session *session);
+static void server_submit(struct server *self, struct server_session *session);
+static void server_update(struct server *self, struct server_session *session);
+static void server_session_close(struct server *self, struct server_session *session);
+static void server_reap(struct server *self);
+static void *server_worker(void *arg);
+static void server_evaluate(struct server_job *job);
+
+int server_open(struct server *self, char const *path, size_t nworkers)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if (nworkers == 0)
+		nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	*self = (struct server) {
+		.path = strdup(path),
+		.listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0),
+		.epoll = epoll_create1(EPOLL_CLOEXEC),
+		.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+		.nworkers = nworkers,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.ready = PTHREAD_COND_INITIALIZER
+	};
+	self->jobs_tail = &self->jobs;
+
+	if (self->listener < 0 || self->epoll < 0 || self->wakeup < 0)
+		goto fail;
+
+	unlink(path);
+	if (bind(self->listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(self->listener, SOMAXCONN) < 0)
+		goto fail;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &self->listener };
+	if (epoll_ctl(self->epoll, EPOLL_CTL_ADD, self->listener, &ev) < 0)
+		goto fail;
+
+	ev.data.ptr = &self->wakeup;
+	if (epoll_ctl(self->epoll, EPOLL_CTL_ADD, self->wakeup, &ev) < 0)
+		goto fail;
+
+	return 0;
+
+fail:;
+	int saved = errno;
+	server_close(self);
+	errno = saved;
+	return -1;
+}
+
+int server_run(struct server *self)
+{
+	self->workers = calloc(self->nworkers, sizeof(pthread_t));
+	size_t started = 0;
+	for (; started < self->nworkers; started++) {
+		int err = pthread_create(&self->workers[started], NULL, server_worker, self);
+		if (err != 0) {
+			errno = err;
+			break;
+		}
+	}
+
+	int status = started > 0 ? 0 : -1;
+
+	while (status == 0 && !atomic_load(&self->stopping)) {
+		struct epoll_event events[MAX_EVENTS];
+		int n = epoll_wait(self->epoll, events, MAX_EVENTS, -1);
+		if (n < 0 && errno != EINTR)
+			status = -1;
+
+		for (int e = 0; e < n; e++) {
+			void *ptr = events[e].data.ptr;
+
+			if (ptr == &self->listener) {
+				server_accept(self);
+			} else if (ptr == &self->wakeup) {
+				server_finish(self);
+			} else {
+				struct server_session *session = ptr;
+				if (session->closed)
+					continue;
+				if (events[e].events & (EPOLLERR | EPOLLHUP))
+					session->dead = true;
+				if (events[e].events & EPOLLIN)
+					server_read(session);
+				if (events[e].events & EPOLLOUT)
+					server_write(session);
+				server_update(self, session);
+			}
+		}
+
+		server_reap(self);
+	}
+
+	int saved = errno;
+
+	pthread_mutex_lock(&self->lock);
+	atomic_store(&self->stopping, true);
+	pthread_cond_broadcast(&self->ready);
+	pthread_mutex_unlock(&self->lock);
+
+	for (size_t w = 0; w < started; w++)
+		pthread_join(self->workers[w], NULL);
+
+	/* The workers finish every queued job before they stop. */
+	for (struct server_job *job = self->done, *next; job; job = next) {
+		next = job->next;
+		job->session->busy = false;
+		free(job->output);
+		free(job);
+	}
+	self->done = NULL;
+
+	while (self->sessions)
+		server_session_close(self, self->sessions);
+	server_reap(self);
+
+	free(self->workers);
+	self->workers = NULL;
+
+	errno = saved;
+	return status;
+}
+
+void server_stop(struct server *self)
+{
+	uint64_t one = 1;
+	atomic_store(&self->stopping, true);
+	if (write(self->wakeup, &one, sizeof(one)) < 0) {
+		/* The counter is already nonzero, so the loop wakes up anyway. */
+	}
+}
+
+void server_close(struct server *self)
+{
+	if (self->listener >= 0) {
+		close(self->listener);
+		unlink(self->path);
+	}
+	if (self->epoll >= 0)
+		close(self->epoll);
+	if (self->wakeup >= 0)
+		close(self->wakeup);
+
+	free(self->path);
+	pthread_mutex_destroy(&self->lock);
+	pthread_cond_destroy(&self->ready);
+}
+
+static void server_accept(struct server *self)
+{
+	int fd;
+	while ((fd = accept4(self->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		struct server_session *session = calloc(1, sizeof(*session));
+		session->fd = fd;
+		session->interpreter = self->reactive ? interpreter_create_reactive(NULL) :
+							interpreter_create(NULL);
+		session->interpreter.budget = self->budget;
+		session->events = EPOLLIN;
+
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = session };
+		if (epoll_ctl(self->epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			interpreter_destroy(&session->interpreter);
+			close(fd);
+			free(session);
+			continue;
+		}
+
+		session->next = self->sessions;
+		if (self->sessions)
+			self->sessions->prev = session;
+		self->sessions = session;
+	}
+}
+
+/* Takes the evaluated jobs back from the workers. */
+static void server_finish(struct server *self)
+{
+	uint64_t count;
+	if (read(self->wakeup, &count, sizeof(count)) < 0) {
+		/* Nothing to read means another wakeup already emptied the list. */
+	}
+
+	pthread_mutex_lock(&self->lock);
+	struct server_job *done = self->done;
+	self->done = NULL;
+	pthread_mutex_unlock(&self->lock);
+
+	while (done) {
+		struct server_job *job = done;
+		struct server_session *session = job->session;
+		done = job->next;
+
+		if (session->out_sent == session->out_length) {
+			free(session->out);
+			session->out = job->output;
+			session->out_length = job->output_length;
+			session->out_sent = 0;
+		} else {
+			size_t pending = session->out_length - session->out_sent;
+			char *out = malloc(pending + job->output_length);
+			memcpy(out, &session->out[session->out_sent], pending);
+			memcpy(&out[pending], job->output, job->output_length);
+			free(session->out);
+			free(job->output);
+			session->out = out;
+			session->out_length = pending + job->output_length;
+			session->out_sent = 0;
+		}
+
+		session->busy = false;
+		free(job);
+
+		server_write(session);
+		server_update(self, session);
+	}
+}
+
+static void server_read(struct server_session *session)
+{
+	while (session->in_length < SERVER_MAX_INPUT) {
+		if (session->in_size - session->in_length < 4096) {
+			session->in_size = session->in_size ? session->in_size * 2 : 8192;
+			session->in = realloc(session->in, session->in_size);
+		}
+
+		ssize_t n = read(session->fd, &session->in[session->in_length],
+				 session->in_size - session->in_length - 1);
+		if (n > 0) {
+			session->in_length += n;
+			continue;
+		}
+
+		if (n == 0) {
+			/* Evaluate a last line that has no newline. */
+			if (session->in_length > 0 &&
+			    session->in[session->in_length - 1] != '\n')
+				session->in[session->in_length++] = '\n';
+			session->eof = true;
+		} else if (errno != EAGAIN && errno != EINTR) {
+			session->dead = true;
+		} else if (errno == EINTR) {
+			continue;
+		}
+
+		break;
+	}
+
+	/* A full buffer without a line in it would never be read from again. */
+	if (session->in_length >= SERVER_MAX_INPUT &&
+	    memchr(session->in, '\n', session->in_length) == NULL)
+		session->dead = true;
+}
+
+static void server_write(struct server_session *session)
+{
+	while (session->out_sent < session->out_length) {
+		ssize_t n = send(session->fd, &session->out[session->out_sent],
+				 session->out_length - session->out_sent, MSG_NOSIGNAL);
+		if (n > 0) {
+			session->out_sent += n;
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else {
+			if (n == 0 || errno != EAGAIN)
+				session->dead = true;
+			return;
+		}
+	}
+}
+
+/* Queues the complete lines of an idle session. */
+static void server_submit(struct server *self, struct server_session *session)
+{
+	char *end = memrchr(session->in, '\n', session->in_length);
+	if (session->busy || end == NULL)
+		return;
+
+	size_t length = end - session->in + 1;
+	struct server_job *job = calloc(1, sizeof(*job));
+	job->session = session;
+	job->input = malloc(length + 1);
+	job->length = length;
+	memcpy(job->input, session->in, length);
+	job->input[length] = '\0';
+
+	memmove(session->in, &session->in[length], session->in_length - length);
+	session->in_length -= length;
+	session->busy = true;
+
+	pthread_mutex_lock(&self->lock);
+	*self->jobs_tail = job;
+	self->jobs_tail = &job->next;
+	pthread_cond_signal(&self->ready);
+	pthread_mutex_unlock(&self->lock);
+}
+
+/* Starts new work for a session, and closes it once there is none left. */
+static void server_update(struct server *self, struct server_session *session)
+{
+	bool flushed = session->out_sent == session->out_length;
+
+	if (session->dead) {
+		/* Stop listening right away, a hung up socket stays readable. */
+		epoll_ctl(self->epoll, EPOLL_CTL_DEL, session->fd, NULL);
+		if (!session->busy)
+			server_session_close(self, session);
+		return;
+	}
+
+	server_submit(self, session);
+
+	if (!session->busy && session->eof && flushed) {
+		server_session_close(self, session);
+		return;
+	}
+
+	/*
+	 * A busy session reads nothing until its lines are done, so a client
+	 * that sends faster than they run is held back by the socket.
+	 */
+	bool reading = !session->eof && !session->busy;
+	uint32_t events = (reading ? EPOLLIN : 0) | (flushed ? 0 : EPOLLOUT);
+	if (events != session->events) {
+		struct epoll_event ev = { .events = events, .data.ptr = session };
+		epoll_ctl(self->epoll, EPOLL_CTL_MOD, session->fd, &ev);
+		session->events = events;
+	}
+}
+
+/*
+ * Events for a closed session can still be pending in the current batch, so
+ * it is only freed by server_reap once the batch is done.
+ */
+static void server_session_close(struct server *self, struct server_session *session)
+{
+	if (session->prev)
+		session->prev->next = session->next;
+	else
+		self->sessions = session->next;
+	if (session->next)
+		session->next->prev = session->prev;
+
+	epoll_ctl(self->epoll, EPOLL_CTL_DEL, session->fd, NULL);
+	close(session->fd);
+
+	session->closed = true;
+	session->next = self->closed;
+	self->closed = session;
+}
+
+static void server_reap(struct server *self)
+{
+	while (self->closed) {
+		struct server_session *session = self->closed;
+		self->closed = session->next;
+
+		interpreter_destroy(&session->interpreter);
+		free(session->in);
+		free(session->out);
+		free(session);
+	}
+}
+
+static void *server_worker(void *arg)
+{
+	struct server *self = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&self->lock);
+		while (self->jobs == NULL && !atomic_load(&self->stopping))
+			pthread_cond_wait(&self->ready, &self->lock);
+
+		struct server_job *job = self->jobs;
+		if (job == NULL) {
+			pthread_mutex_unlock(&self->lock);
+			return NULL;
+		}
+
+		self->jobs = job->next;
+		if (self->jobs == NULL)
+			self->jobs_tail = &self->jobs;
+		pthread_mutex_unlock(&self->lock);
+
+		server_evaluate(job);
+
+		pthread_mutex_lock(&self->lock);
+		job->next = self->done;
+		self->done = job;
+		pthread_mutex_unlock(&self->lock);
+
+		uint64_t one = 1;
+		if (write(self->wakeup, &one, sizeof(one)) < 0) {
+			/* The counter is already nonzero, so the loop wakes up anyway. */
+		}
+	}
+}
+
+/* Evaluates every line of a job like the REPL would. */
+static void server_evaluate(struct server_job *job)
+{
+	struct interpreter *i = &job->session->interpreter;
+	FILE *out = open_memstream(&job->output, &job->output_length);
+	i->output = out;
+
+	for (char *line = job->input, *end; (end = strchr(line, '\n')); line = end + 1) {
+		*end = '\0';
+
+		struct parser parser = parser_create(line);
+		parser.budget = i->budget;
+		struct parser_result res = parser_parse(&parser);
+
+		if (res.error) {
+			diagnostic_print(res.error, out);
+		} else {
+			interpreter_interpret(i, res.ast);
+			if (i->error)
+				diagnostic_print(i->error, out);
+			ast_destroy(res.ast);
+		}
+
+		parser_destroy(&parser);
+		fputc('\0', out);
+	}
+
+	i->output = NULL;
+	fclose(out);
+	free(job->input);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "budget.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Serves interactive sessions over a Unix domain socket. Every connection is
+ * a session with its own interpreter. A client sends lines as it would type
+ * them in the REPL, and gets back, per line, what the REPL would print,
+ * followed by a NUL byte.
+ *
+ * One thread multiplexes all connections with epoll. Complete lines are
+ * parsed and evaluated on a pool of workers, one batch per session at a
+ * time, so that the lines of a session run in order. The workers hand
+ * results back through an eventfd.
+ *
+ * With a budget set, every line is parsed and run within it, and every
+ * session holds at most its number of variables.
+ */
+
+/*
+ * A session buffers at most about this much input, the rest waits in the
+ * socket. One that sends this much without a newline is dropped.
+ */
+#define SERVER_MAX_INPUT (1 << 20)
+
+struct server_job;
+struct server_session;
+
+struct server {
+	char *path;
+	int listener;
+	int epoll;
+	int wakeup;
+	atomic_bool stopping;
+	bool reactive;
+	struct budget const *budget;
+	size_t nworkers;
+	pthread_t *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	struct server_job *jobs;
+	struct server_job **jobs_tail;
+	struct server_job *done;
+	struct server_session *sessions;
+	struct server_session *closed;
+};
+
+/* Both return 0 on success and -1 with errno set on failure. */
+int server_open(struct server *s, char const *path, size_t nworkers);
+int server_run(struct server *s);
+/* Makes server_run return; safe to call from other threads and signal handlers. */
+void server_stop(struct server *s);
+void server_close(struct server *s);
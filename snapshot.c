@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+
+#include "snapshot.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char const snapshot_magic[8] = "CFSNAP1";
+
+static bool snapshot_valid(struct snapshot_header const *h, size_t size);
+
+int snapshot_save(struct interpreter *i, char const *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+
+	struct snapshot_header header = {
+		.nvariables = i->variables.nelts,
+		.last_var = i->last_var,
+		.index_size = i->index_size
+	};
+	memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+	for (size_t v = 0; v < i->variables.nelts; v++)
+		header.names_size += strlen(i->variables.elts[v].name) + 1;
+
+	fwrite(&header, sizeof(header), 1, f);
+
+	uint64_t name = 0;
+	for (size_t v = 0; v < i->variables.nelts; v++) {
+		struct snapshot_record record;
+		memset(&record, 0, sizeof(record));
+		record.value = interpreter_get(i, v);
+		record.name = name;
+		fwrite(&record, sizeof(record), 1, f);
+
+		name += strlen(i->variables.elts[v].name) + 1;
+	}
+
+	if (i->index_size > 0)
+		fwrite(i->index, sizeof(size_t), i->index_size, f);
+
+	for (size_t v = 0; v < i->variables.nelts; v++) {
+		char const *s = i->variables.elts[v].name;
+		fwrite(s, 1, strlen(s) + 1, f);
+	}
+
+	bool failed = ferror(f);
+	if (fclose(f) != 0 || failed)
+		return -1;
+
+	return 0;
+}
+
+int snapshot_load(struct interpreter *i, char const *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	size_t size = st.st_size;
+	if (size < sizeof(struct snapshot_header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	char *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return -1;
+
+	struct snapshot_header const *header = (void *)image;
+	if (!snapshot_valid(header, size)) {
+		munmap(image, size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t n = header->nvariables;
+	struct snapshot_record const *records = (void *)(header + 1);
+	size_t const *index = (void *)(records + n);
+	char *names = (char *)(index + header->index_size);
+
+	struct variable *variables = calloc(n ? n : 1, sizeof(struct variable));
+	size_t *copy = malloc(sizeof(size_t) * (header->index_size ? header->index_size : 1));
+	bool *seen = calloc(n + 1, sizeof(bool));
+	bool valid = variables && copy && seen;
+
+	for (size_t v = 0; valid && v < n; v++) {
+		valid = records[v].name < header->names_size;
+		variables[v] = (struct variable) {
+			.name = &names[records[v].name],
+			.value = records[v].value
+		};
+	}
+
+	/*
+	 * A slot pointing past the table would make lookups read out of bounds,
+	 * and a variable in two slots leaves no empty one to end a probe, so
+	 * every variable must be in exactly one slot.
+	 */
+	for (size_t s = 0; valid && s < header->index_size; s++) {
+		valid = index[s] <= n && (index[s] == 0 || !seen[index[s]]);
+		if (valid)
+			seen[index[s]] = true;
+		copy[s] = index[s];
+	}
+	for (size_t v = 1; valid && v <= n; v++)
+		valid = seen[v];
+
+	if (!valid) {
+		free(variables);
+		free(copy);
+		munmap(image, size);
+		errno = variables && copy && seen ? EINVAL : ENOMEM;
+		free(seen);
+		return -1;
+	}
+
+	free(seen);
+
+	free(i->variables.elts);
+	free(i->index);
+	i->variables = (struct array_variable) {
+		.nelts = n,
+		.nalloc = n ? n : 1,
+		.elts = variables
+	};
+	i->index = copy;
+	i->index_size = header->index_size;
+	i->last_var = header->last_var;
+	i->image = image;
+	i->image_size = size;
+
+	return 0;
+}
+
+static bool snapshot_valid(struct snapshot_header const *h, size_t size)
+{
+	if (memcmp(h->magic, snapshot_magic, sizeof(h->magic)) != 0)
+		return false;
+
+	size_t rest = size - sizeof(*h);
+	if (h->nvariables > rest / sizeof(struct snapshot_record))
+		return false;
+	rest -= h->nvariables * sizeof(struct snapshot_record);
+
+	if (h->index_size > rest / sizeof(size_t))
+		return false;
+	rest -= h->index_size * sizeof(size_t);
+
+	if (h->names_size != rest)
+		return false;
+	if (h->names_size > 0 && ((char const *)h)[size - 1] != '\0')
+		return false;
+
+	/* The index must have room for every variable, like interpreter_index_insert. */
+	if (h->index_size & (h->index_size - 1))
+		return false;
+	if (h->nvariables > 0 && h->nvariables * 2 > h->index_size)
+		return false;
+
+	return h->last_var >= -1 && h->last_var < (int64_t)h->nvariables;
+}
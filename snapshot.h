@@ -0,0 +1,34 @@
+#pragma once
+
+#include "interpreter.h"
+#include <stdint.h>
+
+/*
+ * A session saved as one image: a header, a record per variable, the hash
+ * index of the variable table and all names, NUL terminated, in table order.
+ * Loading maps the file and points the names into the mapping, so the cost
+ * does not depend on how long the names are and nothing is allocated per
+ * variable. Images use the byte order of the machine that wrote them.
+ *
+ * Reactive formulas are not saved; their current values are.
+ *
+ * Both functions return 0 on success and -1 with errno set on failure.
+ * snapshot_load expects a freshly created interpreter, which it leaves
+ * untouched on failure.
+ */
+
+struct snapshot_header {
+	char magic[8];
+	uint64_t nvariables;
+	int64_t last_var;
+	uint64_t index_size;
+	uint64_t names_size;
+};
+
+struct snapshot_record {
+	struct value value;
+	uint64_t name;
+};
+
+int snapshot_save(struct interpreter *i, char const *path);
+int snapshot_load(struct interpreter *i, char const *path);
@@ -0,0 +1,146 @@
+#include "stream.h"
+#include "lexer.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <string.h>
+
+array_create_declare(uint8_t, u8)
+array_destroy_declare(uint8_t, u8)
+array_push_declare(uint8_t, u8)
+
+array_create_declare(uint32_t, u32)
+array_destroy_declare(uint32_t, u32)
+array_push_declare(uint32_t, u32)
+
+array_create_declare(union stream_payload, payload)
+array_destroy_declare(union stream_payload, payload)
+array_push_declare(union stream_payload, payload)
+
+array_create_declare(struct stream_line, line)
+array_destroy_declare(struct stream_line, line)
+array_push_declare(struct stream_line, line)
+
+static int stream_length(struct stream const *s, struct token t);
+
+struct stream stream_create(char *input)
+{
+	struct stream s = {
+		.input = input,
+		.types = array_create_u8(),
+		.offsets = array_create_u32(),
+		.payloads = array_create_payload(),
+		.lines = array_create_line()
+	};
+
+	struct lexer l = lexer_create(input);
+
+	for (;;) {
+		struct token t = lexer_next_token(&l);
+
+		bool real = t.type == token_number && t.number_value.type == value_real;
+
+		*array_push_u8(&s.types) = t.type | (real ? STREAM_REAL : 0);
+		*array_push_u32(&s.offsets) = t.span.offset;
+
+		if (real)
+			array_push_payload(&s.payloads)->real = t.number_value.real;
+		else if (t.type == token_number)
+			array_push_payload(&s.payloads)->integer = t.number_value.integer;
+		else if (t.type == token_name)
+			array_push_payload(&s.payloads)->length = t.name_length;
+		else if (t.type == token_none)
+			array_push_payload(&s.payloads)->error = t.error;
+
+		if (s.lines.nelts == 0 ||
+		    s.lines.elts[s.lines.nelts - 1].line != (uint32_t)t.span.line) {
+			*array_push_line(&s.lines) = (struct stream_line) {
+				.line = t.span.line,
+				.start = t.span.offset - (t.span.column - 1)
+			};
+		}
+
+		if (t.type == token_end)
+			break;
+	}
+
+	return s;
+}
+
+void stream_destroy(struct stream *self)
+{
+	array_destroy_u8(self->types);
+	array_destroy_u32(self->offsets);
+	array_destroy_payload(self->payloads);
+	array_destroy_line(self->lines);
+}
+
+/* Reads the token at the cursor and advances it; the end token repeats. */
+struct token stream_next(struct stream const *self, struct stream_cursor *c)
+{
+	size_t i = c->token;
+	if (i + 1 < self->types.nelts)
+		c->token++;
+
+	enum token_type type = self->types.elts[i] & ~STREAM_REAL;
+	bool real = self->types.elts[i] & STREAM_REAL;
+	uint32_t offset = self->offsets.elts[i];
+	struct token t;
+
+	switch (type) {
+	case token_number: {
+		union stream_payload p = self->payloads.elts[c->payload++];
+		t = token_create_number(real ? value_create_real(p.real) :
+					       value_create_integer(p.integer));
+		break;
+	}
+	case token_name:
+		t = token_create_name(&self->input[offset],
+				      self->payloads.elts[c->payload++].length);
+		break;
+	case token_none:
+		t = token_create_error(self->payloads.elts[c->payload++].error);
+		break;
+	default:
+		t = token_create(type);
+		break;
+	}
+
+	while (c->line + 1 < self->lines.nelts &&
+	       self->lines.elts[c->line + 1].start <= offset)
+		c->line++;
+
+	struct stream_line line = self->lines.elts[c->line];
+	t.span = (struct span) {
+		.offset = offset,
+		.line = line.line,
+		.column = offset - line.start + 1
+	};
+	t.span.length = stream_length(self, t);
+
+	return t;
+}
+
+static int stream_length(struct stream const *self, struct token t)
+{
+	char const *p = &self->input[t.span.offset];
+	int n = 0;
+
+	switch (t.type) {
+	case token_end:
+		return 0;
+	case token_name:
+		return t.name_length;
+	case token_number:
+		while (isdigit(p[n]))
+			n++;
+		return n;
+	case token_none:
+		if (t.error == token_error_invalid_character)
+			return 1;
+		while (isalpha(p[n]))
+			n++;
+		return n;
+	default:
+		return strlen(token_type_to_string(t.type));
+	}
+}
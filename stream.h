@@ -0,0 +1,52 @@
+#pragma once
+
+#include "array.h"
+#include "token.h"
+#include <stdint.h>
+
+/*
+ * The whole input tokenized up front into packed arrays: one type byte and
+ * one 32 bit offset per token, and a payload only for tokens that carry a
+ * value (numbers, name lengths and lexical errors), in token order. Lines are
+ * stored once per line that has tokens. Inputs must be smaller than 4 GiB.
+ *
+ * A number is an integer unless its type byte has STREAM_REAL set.
+ */
+
+#define STREAM_REAL 0x80
+
+union stream_payload {
+	int64_t integer;
+	double real;
+	uint32_t length;
+	enum token_error error;
+};
+
+struct stream_line {
+	uint32_t line;
+	uint32_t start;
+};
+
+array_declare(uint8_t, u8)
+array_declare(uint32_t, u32)
+array_declare(union stream_payload, payload)
+array_declare(struct stream_line, line)
+
+struct stream {
+	char *input;
+	struct array_u8 types;
+	struct array_u32 offsets;
+	struct array_payload payloads;
+	struct array_line lines;
+};
+
+/* Position of a reader in a stream; start with a zeroed cursor. */
+struct stream_cursor {
+	size_t token;
+	size_t payload;
+	size_t line;
+};
+
+struct stream stream_create(char *input);
+void stream_destroy(struct stream *s);
+struct token stream_next(struct stream const *s, struct stream_cursor *c);
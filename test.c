@@ -1,10 +1,24 @@
+#define _GNU_SOURCE
+
 #include "parser.h"
 #include "array.h"
+#include "cache.h"
+#include "compiler.h"
+#include "interpreter.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "profile.h"
+#include "schedule.h"
+#include "server.h"
+#include "snapshot.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 bool parser_errs(char *input)
 {
@@ -21,6 +35,67 @@ bool parser_errs(char *input)
 	return true;
 }
 
+bool parser_reports(char *input, char *message)
+{
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+
+	if (!res.error) {
+		ast_destroy(res.ast);
+		parser_destroy(&parser);
+		return false;
+	}
+
+	char buf[512];
+	diagnostic_format(res.error, buf, sizeof(buf));
+	parser_destroy(&parser);
+	return strcmp(buf, message) == 0;
+}
+
+bool parser_recovers(char *input, size_t nerrors, int line, int column)
+{
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+
+	bool ok = res.error && parser.diagnostics.nelts == nerrors &&
+		  res.error == &parser.diagnostics.elts[0];
+	if (ok) {
+		struct span last = parser.diagnostics.elts[nerrors - 1].span;
+		ok = last.line == line && last.column == column;
+	}
+
+	parser_destroy(&parser);
+	return ok;
+}
+
+bool stream_matches_lexer(char *input)
+{
+	struct stream s = stream_create(input);
+	struct stream_cursor c = { 0 };
+	struct lexer l = lexer_create(input);
+	bool same = true;
+
+	for (;;) {
+		struct token want = lexer_next_token(&l);
+		struct token got = stream_next(&s, &c);
+
+		same = same && want.type == got.type &&
+		       memcmp(&want.span, &got.span, sizeof(struct span)) == 0;
+		if (want.type == token_name)
+			same = same && got.name_value == want.name_value &&
+			       got.name_length == want.name_length;
+		if (want.type == token_number)
+			same = same && value_equal(got.number_value, want.number_value);
+
+		if (want.type == token_end)
+			break;
+	}
+
+	same = same && stream_next(&s, &c).type == token_end;
+	stream_destroy(&s);
+	return same;
+}
+
 bool parser_gives(char *input, char *ast)
 {
 	struct parser parser = parser_create(input);
@@ -46,6 +121,469 @@ bool parser_gives(char *input, char *ast)
 	return true;
 }
 
+bool optimizer_gives(char *input, char *ast)
+{
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.error);
+
+	optimizer_optimize(res.ast);
+	char *s = ast_to_string(res.ast);
+	bool same = strcmp(s, ast) == 0;
+
+	free(s);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+	return same;
+}
+
+bool parallel_matches(char *input, size_t nthreads)
+{
+	struct parser parser = parser_create(input);
+	struct parser_result want = parser_parse(&parser);
+
+	struct array_diagnostic diagnostics = { 0 };
+	struct parser_result got = parallel_parse(input, nthreads, &diagnostics);
+
+	bool same = diagnostics.nelts == parser.diagnostics.nelts;
+	for (size_t i = 0; same && i < diagnostics.nelts; i++)
+		same = memcmp(&diagnostics.elts[i].span, &parser.diagnostics.elts[i].span,
+			      sizeof(struct span)) == 0;
+
+	if (want.ast && got.ast) {
+		same = same && ast_equal(want.ast, got.ast);
+		for (size_t i = 0; same && i < want.ast->children.nelts; i++)
+			same = memcmp(&want.ast->children.elts[i]->span,
+				      &got.ast->children.elts[i]->span,
+				      sizeof(struct span)) == 0;
+	} else {
+		same = same && !want.ast && !got.ast;
+	}
+
+	if (want.ast)
+		ast_destroy(want.ast);
+	if (got.ast)
+		ast_destroy(got.ast);
+	free(diagnostics.elts);
+	parser_destroy(&parser);
+	return same;
+}
+
+/* With repeats, a tenth of the statements is in the body of one. */
+static char *generate(size_t nstatements, bool errors, bool repeats)
+{
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+
+	for (size_t i = 0; i < nstatements; i++) {
+		if (repeats && errors && i % 5000 == 2500)
+			fprintf(f, "herhaal ) keer\n");
+		else if (repeats && i % 1000 == 500)
+			fprintf(f, "herhaal 2 keer\n");
+
+		if (errors && i % 5000 == 17)
+			fprintf(f, "print @ uit;\n");
+		else if (i % 3 == 0)
+			fprintf(f, "laat x%c %zu * het zijn; ", 'a' + (int)(i % 26), i);
+		else
+			fprintf(f, "print (x + %zu) uit;\n", i);
+
+		if (repeats && i % 1000 == 599)
+			fprintf(f, "klaar;\n");
+		if (repeats && errors && i % 5000 == 4000)
+			fprintf(f, "klaar;\n");
+	}
+
+	fclose(f);
+	return buf;
+}
+
+static char *interpret(char *input)
+{
+	char *out;
+	size_t len;
+	FILE *f = open_memstream(&out, &len);
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.error);
+
+	struct interpreter i = interpreter_create(f);
+	interpreter_interpret(&i, res.ast);
+	if (i.error)
+		diagnostic_print(i.error, f);
+
+	interpreter_destroy(&i);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+	fclose(f);
+	return out;
+}
+
+bool reactive_gives(char *input, char const *want)
+{
+	char *got;
+	size_t len;
+	FILE *f = open_memstream(&got, &len);
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.error);
+
+	struct interpreter i = interpreter_create_reactive(f);
+	interpreter_interpret(&i, res.ast);
+	if (i.error)
+		diagnostic_print(i.error, f);
+
+	interpreter_destroy(&i);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+	fclose(f);
+
+	bool same = strcmp(want, got) == 0;
+	free(got);
+	return same;
+}
+
+/* Profiles input and checks "line:column count ops lookups" of every statement. */
+bool profile_counts(char *input, char const *want)
+{
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.error);
+
+	FILE *null = fopen("/dev/null", "w");
+	struct profile profile = profile_create();
+	struct interpreter i = interpreter_create(null);
+	i.profile = &profile;
+	interpreter_interpret(&i, res.ast);
+
+	char *got;
+	size_t len;
+	FILE *f = open_memstream(&got, &len);
+	for (size_t e = 0; e < profile.entries.nelts; e++) {
+		struct profile_entry *entry = &profile.entries.elts[e];
+		fprintf(f, "%d:%d %s %zu %zu %zu;", entry->span.line, entry->span.column,
+			entry->label, (size_t)entry->count, (size_t)entry->ops,
+			(size_t)entry->lookups);
+	}
+	fclose(f);
+
+	bool same = strcmp(got, want) == 0;
+
+	free(got);
+	profile_destroy(&profile);
+	interpreter_destroy(&i);
+	fclose(null);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+	return same;
+}
+
+bool schedule_matches(char *input, size_t nthreads)
+{
+	char *got;
+	size_t len;
+	FILE *f = open_memstream(&got, &len);
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.error);
+
+	struct interpreter i = interpreter_create(f);
+	schedule_interpret(&i, res.ast, nthreads);
+	if (i.error)
+		diagnostic_print(i.error, f);
+
+	interpreter_destroy(&i);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+	fclose(f);
+
+	char *want = interpret(input);
+	bool same = strcmp(want, got) == 0;
+	free(want);
+	free(got);
+	return same;
+}
+
+/* Runs input by direct evaluation; want NULL means as interpret does. */
+bool direct_gives(char *input, char const *want)
+{
+	char *got;
+	size_t len;
+	FILE *f = open_memstream(&got, &len);
+	struct interpreter i = interpreter_create(f);
+	struct parser parser = parser_create_direct(input, &i);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.ast);
+	if (res.error)
+		diagnostic_print(res.error, f);
+
+	parser_destroy(&parser);
+	interpreter_destroy(&i);
+	fclose(f);
+
+	char *expected = want ? strdup(want) : interpret(input);
+	bool same = strcmp(expected, got) == 0;
+	free(expected);
+	free(got);
+	return same;
+}
+
+/* Runs input within the budget spec, as a tree and directly, which must agree. */
+bool budget_gives(char *input, char const *spec, char const *want)
+{
+	struct budget budget;
+	assert(budget_parse(&budget, spec) == 0);
+
+	char *got[3];
+	for (int direct = 0; direct < 2; direct++) {
+		size_t len;
+		FILE *f = open_memstream(&got[direct], &len);
+		struct interpreter i = interpreter_create(f);
+		i.budget = &budget;
+
+		struct parser parser = direct ? parser_create_direct(input, &i) : parser_create(input);
+		parser.budget = &budget;
+		struct parser_result res = parser_parse(&parser);
+		if (res.ast)
+			interpreter_interpret(&i, res.ast);
+		if (res.error || i.error)
+			diagnostic_print(res.error ? res.error : i.error, f);
+
+		ast_destroy(res.ast);
+		parser_destroy(&parser);
+		interpreter_destroy(&i);
+		fclose(f);
+	}
+
+	/* As one line of an incremental session. */
+	size_t len;
+	FILE *f = open_memstream(&got[2], &len);
+	struct interpreter i = interpreter_create(f);
+	struct cache cache = cache_create();
+	i.budget = &budget;
+	struct diagnostic const *error = cache_run(&cache, &i, input);
+	if (error)
+		diagnostic_print(error, f);
+	cache_destroy(&cache);
+	interpreter_destroy(&i);
+	fclose(f);
+
+	bool same = true;
+	for (int n = 0; n < 3; n++) {
+		same = same && strcmp(got[n], want) == 0;
+		free(got[n]);
+	}
+	return same;
+}
+
+/* Whether an incremental session reports the error of line where a run does. */
+bool cache_points(char *line)
+{
+	FILE *null = fopen("/dev/null", "w");
+	struct interpreter i = interpreter_create(null);
+	struct parser parser = parser_create(line);
+	struct parser_result res = parser_parse(&parser);
+	if (res.ast)
+		interpreter_interpret(&i, res.ast);
+	struct diagnostic want = *(res.error ? res.error : i.error);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+	interpreter_destroy(&i);
+
+	struct cache cache = cache_create();
+	i = interpreter_create(null);
+	struct diagnostic got = *cache_run(&cache, &i, line);
+	cache_destroy(&cache);
+	interpreter_destroy(&i);
+	fclose(null);
+
+	return got.code == want.code && got.span.offset == want.span.offset &&
+	       got.span.line == want.span.line && got.span.column == want.span.column;
+}
+
+/* Runs setup, which should print nothing, then after on a restored snapshot. */
+bool snapshot_matches(char *setup, char *after)
+{
+	char path[] = "/tmp/cfeitsma-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return false;
+	close(fd);
+
+	struct parser parser = parser_create(setup);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.error);
+
+	struct interpreter saved = interpreter_create_reactive(stdout);
+	interpreter_interpret(&saved, res.ast);
+	bool same = !saved.error && snapshot_save(&saved, path) == 0;
+	interpreter_destroy(&saved);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+
+	char *got;
+	size_t len;
+	FILE *f = open_memstream(&got, &len);
+	struct interpreter loaded = interpreter_create(f);
+	same = same && snapshot_load(&loaded, path) == 0;
+
+	parser = parser_create(after);
+	res = parser_parse(&parser);
+	assert(!res.error);
+	interpreter_interpret(&loaded, res.ast);
+	if (loaded.error)
+		diagnostic_print(loaded.error, f);
+	interpreter_destroy(&loaded);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+	fclose(f);
+
+	/* An index naming one variable in every slot is refused. */
+	struct snapshot_header header;
+	FILE *image = fopen(path, "r+b");
+	same = same && image && fread(&header, sizeof(header), 1, image) == 1;
+	if (same && header.nvariables > 0) {
+		size_t first = 1;
+		fseek(image, sizeof(header) + header.nvariables * sizeof(struct snapshot_record),
+		      SEEK_SET);
+		for (size_t s = 0; s < header.index_size; s++)
+			fwrite(&first, sizeof(first), 1, image);
+		fflush(image);
+		struct interpreter looping = interpreter_create(stdout);
+		same = snapshot_load(&looping, path) < 0 && looping.variables.nelts == 0;
+		interpreter_destroy(&looping);
+	}
+	if (image)
+		fclose(image);
+
+	/* A truncated image is refused. */
+	same = same && truncate(path, 20) == 0;
+	struct interpreter broken = interpreter_create(stdout);
+	same = same && snapshot_load(&broken, path) < 0 && broken.variables.nelts == 0;
+	interpreter_destroy(&broken);
+	remove(path);
+
+	char *both;
+	asprintf(&both, "%s %s", setup, after);
+	char *want = interpret(both);
+	same = same && strcmp(want, got) == 0;
+
+	free(both);
+	free(want);
+	free(got);
+	return same;
+}
+
+static void *server_thread(void *arg)
+{
+	return (void *)(intptr_t)server_run(arg);
+}
+
+/* Sends the lines of every client on its own connection and checks the answers. */
+bool server_gives(char **lines, char **want, size_t nclients)
+{
+	char path[] = "/tmp/cfeitsma-XXXXXX";
+	if (mkdtemp(path) == NULL)
+		return false;
+
+	char *socket_path;
+	asprintf(&socket_path, "%s/sock", path);
+
+	struct server server;
+	if (server_open(&server, socket_path, 2) < 0)
+		return false;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, server_thread, &server);
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strcpy(addr.sun_path, socket_path);
+
+	int *fds = calloc(nclients, sizeof(int));
+	for (size_t c = 0; c < nclients; c++) {
+		fds[c] = socket(AF_UNIX, SOCK_STREAM, 0);
+		connect(fds[c], (struct sockaddr *)&addr, sizeof(addr));
+		write(fds[c], lines[c], strlen(lines[c]));
+		shutdown(fds[c], SHUT_WR);
+	}
+
+	bool same = true;
+	for (size_t c = 0; c < nclients; c++) {
+		char got[4096] = { 0 };
+		size_t length = 0;
+		ssize_t n;
+		while ((n = read(fds[c], &got[length], sizeof(got) - 1 - length)) > 0)
+			length += n;
+
+		for (char *p = got; p < got + length; p++) {
+			if (*p == '\0')
+				*p = '|';
+		}
+		same = same && strcmp(got, want[c]) == 0;
+		close(fds[c]);
+	}
+
+	server_stop(&server);
+	void *status;
+	pthread_join(thread, &status);
+	server_close(&server);
+
+	rmdir(path);
+	free(socket_path);
+	free(fds);
+	return same && status == 0;
+}
+
+bool compiler_matches(char *input)
+{
+	char dir[] = "/tmp/cfeitsma-XXXXXX";
+	if (mkdtemp(dir) == NULL)
+		return false;
+
+	char *source, *binary, *output, *command;
+	asprintf(&source, "%s/out.c", dir);
+	asprintf(&binary, "%s/out", dir);
+	asprintf(&output, "%s/out.txt", dir);
+
+	struct parser parser = parser_create(input);
+	struct parser_result res = parser_parse(&parser);
+	assert(!res.error);
+
+	FILE *f = fopen(source, "w");
+	struct compiler c = compiler_create(f);
+	compiler_compile(&c, res.ast);
+	compiler_destroy(&c);
+	fclose(f);
+	ast_destroy(res.ast);
+	parser_destroy(&parser);
+
+	char const *cc = getenv("CC") ? getenv("CC") : "cc";
+	asprintf(&command, "%s -O2 -ffp-contract=off -o %s %s -lm && %s > %s; "
+		 "rm -f %s", cc, binary, source, binary, output, binary);
+	system(command);
+	free(command);
+
+	char *want = interpret(input);
+	char got[4096] = { 0 };
+	f = fopen(output, "r");
+	if (f) {
+		fread(got, 1, sizeof(got) - 1, f);
+		fclose(f);
+	}
+
+	bool same = strcmp(want, got) == 0;
+
+	remove(source);
+	remove(output);
+	rmdir(dir);
+	free(want);
+	free(source);
+	free(binary);
+	free(output);
+	return same;
+}
+
 array_all_declare(int, int)
 
 int main(void)
@@ -57,6 +595,26 @@ int main(void)
 	assert(parser_errs("laat tau pi * pi * zijn;"));
 	assert(parser_errs("laat tau pi * zijn zijn;"));
 
+	assert(parser_reports("laat @ x zijn;", "Invalid character: '@'"));
+	assert(parser_reports("print 2 uit", "Want ;, got <end>."));
+	assert(parser_reports("print 2 x;", "Want uit, got <\"x\">."));
+	assert(parser_reports("laat x 3 4 zijn;", "Want zijn, got <4.00000>."));
+	assert(parser_reports("herhaal 2 keer print 1 uit;", "Want klaar, got <end>."));
+	assert(parser_reports("print abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz"
+			      "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz uit;",
+			      "Name starting with \"abcdefghij\" is too long!"));
+
+	assert(parser_recovers("print x uit;\nprint @ uit;", 1, 2, 7));
+	assert(parser_recovers("print 1 +; laat x zijn;\n\n  laat x 1 zijn", 3, 3, 16));
+	assert(parser_recovers("laat x 1 zijn print 2 uit; print ) uit; print 3 uit;", 2, 1, 34));
+	assert(parser_recovers("herhaal 2 keer print @ uit; laat x klaar;\n"
+			       "herhaal ) keer herhaal 1 keer print 1 uit; klaar; klaar; klaar; print ; ",
+			       5, 2, 71));
+
+	assert(stream_matches_lexer(""));
+	assert(stream_matches_lexer("laat x 12 zijn;\n\n  print (x + het) * 3 uit; @\nprint y uit;"));
+	assert(stream_matches_lexer("print 99999999999999999999 + 1 uit;"));
+
 	assert(parser_gives("", "program"));
 	assert(parser_gives("print pi uit;", "program (print (\"pi\"))"));
 	assert(parser_gives("print pi uit; print tau uit;",
@@ -65,6 +623,257 @@ int main(void)
 			    "program (print (+ (2.00000, 2.00000)))"));
 	assert(parser_gives("laat tau pi * pi zijn;",
 			    "program (= (\"tau\", * (\"pi\", \"pi\")))"));
+	assert(parser_gives("herhaal n keer herhaal 2 keer klaar; print het uit; klaar;",
+			    "program (herhaal (\"n\", program (herhaal (2.00000, program), "
+			    "print (het))))"));
+
+	assert(optimizer_gives("laat x a * b zijn; print a * b + 1 uit;",
+			       "program (= (\"x\", * (\"a\", \"b\")), "
+			       "print (+ (\"x\", 1.00000)))"));
+	assert(optimizer_gives("laat x a * b zijn; laat a 2 zijn; print a * b uit;",
+			       "program (= (\"x\", * (\"a\", \"b\")), "
+			       "= (\"a\", 2.00000), print (* (\"a\", \"b\")))"));
+	assert(optimizer_gives("laat x 1 zijn; laat x 2 zijn; print x uit;",
+			       "program (= (\"x\", 2.00000), print (\"x\"))"));
+	assert(optimizer_gives("laat x 1 zijn; laat het 2 zijn; print het uit;",
+			       "program (= (\"x\", 2.00000), print (\"x\"))"));
+	assert(optimizer_gives("laat x 1 zijn; print y uit; laat x 2 zijn;",
+			       "program (= (\"x\", 1.00000), print (\"y\"), "
+			       "= (\"x\", 2.00000))"));
+	assert(optimizer_gives("laat x y zijn; laat x 2 zijn;",
+			       "program (= (\"x\", \"y\"), = (\"x\", 2.00000))"));
+	assert(optimizer_gives("laat x 1 zijn; laat y 1 zijn; laat x y zijn;",
+			       "program (= (\"y\", 1.00000), = (\"x\", \"y\"))"));
+	assert(optimizer_gives("laat a 1 zijn; laat x a * a zijn; herhaal het keer "
+			       "laat y a * a zijn; laat y x zijn; klaar; print a * a uit;",
+			       "program (= (\"a\", 1.00000), = (\"x\", * (\"a\", \"a\")), "
+			       "herhaal (\"x\", program (= (\"y\", \"x\"))), "
+			       "print (* (\"a\", \"a\")))"));
+
+	char *large = generate(40000, false, false);
+	assert(parallel_matches(large, 4));
+	assert(parallel_matches(large, 1));
+	free(large);
+	large = generate(40000, true, false);
+	assert(parallel_matches(large, 3));
+	free(large);
+	assert(parallel_matches("print 1 uit;", 4));
+	large = generate(40000, false, true);
+	assert(parallel_matches(large, 4));
+	free(large);
+	large = generate(40000, true, true);
+	assert(parallel_matches(large, 3));
+	free(large);
+
+	/* Small chunks are cut inside the bodies of repeats and joined again. */
+	size_t min_chunk = parallel_min_chunk;
+	parallel_min_chunk = 8;
+	assert(parallel_matches("print 1 uit; herhaal 2 keer print 2 uit; herhaal 2 keer "
+				"print 3 uit; klaar; print 4 uit; klaar; klaar; print 5 uit; "
+				"print 6 uit;", 16));
+	assert(parallel_matches("herhaal 2 keer print 1 uit; print 2 uit; print 3 uit;", 8));
+	parallel_min_chunk = min_chunk;
+
+	large = generate(40000, false, false);
+	char *defined;
+	asprintf(&defined, "laat x 1 zijn; %s", large);
+	assert(schedule_matches(defined, 4));
+	assert(schedule_matches(defined, 1));
+	free(defined);
+	asprintf(&defined, "laat x 1 zijn; %s laat het y zijn; print 1 uit;", large);
+	assert(schedule_matches(defined, 3));
+	free(defined);
+	free(large);
+	assert(schedule_matches("laat het 1 zijn; print 2 uit;", 4));
+	large = generate(40000, false, false);
+	asprintf(&defined, "laat x 1 zijn; %s herhaal 3 keer laat x x * 2 zijn; klaar; %s "
+		 "herhaal x - 9 keer print het uit; klaar; print 1 uit;", large, large);
+	assert(schedule_matches(defined, 4));
+	free(defined);
+	free(large);
+	assert(schedule_matches("laat x 1 zijn; laat het het + x zijn; print x uit;", 4));
+	/* Two wide waves, which do run on threads, unlike the chains above. */
+	size_t ndefined;
+	FILE *f = open_memstream(&defined, &ndefined);
+	fputs("laat x 3 zijn; ", f);
+	for (int n = 0; n < 20000; n++)
+		fprintf(f, "laat v%c%c %d * x zijn; print v%c%c - het uit; ", 'a' + n / 26 % 26,
+			'a' + n % 26, n, 'a' + n / 26 % 26, 'a' + n % 26);
+	fputs("print y uit;", f);
+	fclose(f);
+	assert(schedule_matches(defined, 4));
+	free(defined);
+
+	large = generate(4000, false, true);
+	asprintf(&defined, "laat x 1 zijn; %s", large);
+	assert(direct_gives(defined, NULL));
+	free(defined);
+	free(large);
+	large = generate(4000, false, true);
+	asprintf(&defined, "laat x 1 zijn; %s herhaal 2 keer print y uit; klaar; %s", large, large);
+	assert(direct_gives(defined, NULL));
+	free(defined);
+	free(large);
+	assert(direct_gives("laat x 2 zijn; laat het het * (het + 1) zijn; print x / 4 uit;", NULL));
+	assert(direct_gives("laat het 1 zijn;", NULL));
+	assert(direct_gives("print 1 uit; print y + 1 uit; print 2 uit;", NULL));
+	assert(direct_gives("print 1 uit; herhaal 2 keer print 2 uit; print @ uit; klaar;",
+			    "1.000000\nInvalid character: '@'\n"));
+	assert(budget_gives("print 1 + 2 * 3 uit;", "nodes=6,depth=2", "7.000000\n"));
+	assert(budget_gives("print 1 + 2 * 3 uit;", "nodes=5", "program is larger than 5 nodes\n"));
+	assert(budget_gives("print 1 - 2 - 3 uit; print 4 uit;", "depth=1", "nested deeper than 1\n"));
+	assert(budget_gives("print (((1))) uit;", "depth=2", "nested deeper than 2\n"));
+	assert(budget_gives("herhaal 1 keer herhaal 1 keer klaar; klaar;", "depth=1",
+			    "nested deeper than 1\n"));
+	assert(budget_gives("laat a 1 zijn; laat a 2 zijn; laat b 3 zijn; print a uit;",
+			    "variables=1", "more than 1 variables\n"));
+	assert(budget_gives("herhaal 3 keer print 1 uit; klaar; print 2 uit;", "statements=5",
+			    "1.000000\n1.000000\nran more than 5 statements\n"));
+	assert(budget_gives("laat x 1 zijn; laat y 2 zijn; print y uit;", "statements=1",
+			    "ran more than 1 statements\n"));
+	assert(budget_gives("herhaal 1000000000000000000 keer klaar;", "statements=100",
+			    "ran more than 100 statements\n"));
+	assert(budget_gives("herhaal 1000000000 keer herhaal 1000000000 keer klaar; klaar;",
+			    "ms=5", "ran longer than 5 ms\n"));
+	assert(budget_gives("herhaal 1000000000000 keer laat x 1 zijn; klaar;", "ms=5",
+			    "ran longer than 5 ms\n"));
+	struct budget budget;
+	assert(budget_parse(&budget, "") == 0 && budget.nodes == 0);
+	assert(budget_parse(&budget, "depth=3,ms=9") == 0 && budget.depth == 3 &&
+	       budget.milliseconds == 9);
+	assert(budget_parse(&budget, "depth=3,") == 0);
+	assert(budget_parse(&budget, "depth") < 0);
+	assert(budget_parse(&budget, "depth=-1") < 0);
+	assert(budget_parse(&budget, "size=1") < 0);
+	assert(direct_gives("print y + ( uit;", "Want number, name, het, or (, got <uit>.\n"));
+	assert(direct_gives("print 1 uit; print 2 uit print 3 uit;",
+			    "1.000000\nWant ;, got <print>.\n"));
+
+	assert(reactive_gives("laat a 1 zijn; laat b a * 2 zijn; laat a 5 zijn; print b uit;",
+			      "10.000000\n"));
+	assert(reactive_gives("laat a 1 zijn; laat b het + 1 zijn; laat c b * b zijn; "
+			      "print c uit; laat a 2 zijn; print c uit; print het uit;",
+			      "4.000000\n9.000000\n2.000000\n"));
+	assert(reactive_gives("laat a 1 zijn; laat b a zijn; laat a b + 1 zijn; "
+			      "laat a 7 zijn; print b uit; print a uit;",
+			      "7.000000\n7.000000\n"));
+	assert(reactive_gives("laat a 1 zijn; laat a a + 1 zijn; laat b a zijn; "
+			      "laat b 3 zijn; laat a 0 zijn; print b uit;",
+			      "3.000000\n"));
+	assert(reactive_gives("laat a 1 zijn; laat b a + c zijn; print b uit;",
+			      "variable named \"c\" doesn't exist\n"));
+
+	/* A chain of formulas is as deep as the program is long. */
+	char *chain;
+	size_t nchain;
+	f = open_memstream(&chain, &nchain);
+	fputs("laat vaaaa 0 zijn; ", f);
+	for (int n = 1; n < 300000; n++)
+		fprintf(f, "laat v%c%c%c%c het + 1 zijn; ", 'a' + n / 17576, 'a' + n / 676 % 26,
+			'a' + n / 26 % 26, 'a' + n % 26);
+	fputs("print vrbul uit; laat vaaaa 2 zijn; print vrbul uit; "
+	      "laat vrbul vrbuk * 2 zijn; print vrbul uit;", f);
+	fclose(f);
+	assert(reactive_gives(chain, "299999.000000\n300001.000000\n600000.000000\n"));
+	free(chain);
+
+	assert(profile_counts("laat x 1 zijn;\nlaat y x + x * 2 zijn; print y uit;\n"
+			      "  laat het het / y zijn; print z uit;",
+			      "1:1 laat x 1 0 0;2:1 laat y 1 2 2;2:24 print 1 0 1;"
+			      "3:3 laat het 1 1 2;3:26 print 1 0 1;"));
+	assert(profile_counts("laat x 0 zijn; herhaal 3 keer laat x x + 1 zijn; "
+			      "herhaal x keer klaar; klaar;",
+			      "1:1 laat x 1 0 0;1:16 herhaal 1 3 6;1:31 laat x 3 3 3;"
+			      "1:50 herhaal 3 0 3;"));
+
+	assert(snapshot_matches("", "print 1 uit;"));
+	assert(snapshot_matches("laat a 9007199254740993 zijn; laat b a / 2 zijn; laat c 5 zijn;",
+				"print het uit; laat het b * 2 zijn; print c + a uit; print b uit;"));
+	assert(snapshot_matches("laat x 1 zijn; laat xb 2 zijn; laat xz x + xb zijn;",
+				"print xz uit; laat xa xz * 2 zijn; print xa uit; print y uit;"));
+
+	char *many;
+	size_t nmany;
+	f = open_memstream(&many, &nmany);
+	for (int n = 0; n < 26 * 26 * 26; n++)
+		fprintf(f, "laat v%c%c%c %d zijn; ", 'a' + n / 676, 'a' + n / 26 % 26, 'a' + n % 26, n);
+	fclose(f);
+	assert(snapshot_matches(many, "print vaaa + vzzz uit; print vmno uit; print het uit;"));
+	free(many);
+
+	assert(server_gives((char *[]) {
+		"laat a 2 zijn; print a uit;\nprint b uit;\nprint a * 3 uit;",
+		"print a uit;\nlaat a 5 zijn;\nprint het uit;\n",
+		"print @ uit;\n\n"
+	}, (char *[]) {
+		"2.000000\n|variable named \"b\" doesn't exist\n|6.000000\n|",
+		"variable named \"a\" doesn't exist\n||5.000000\n|",
+		"Invalid character: '@'\n||"
+	}, 3));
+
+	/* A full buffer without a newline closes the connection unanswered. */
+	char *unended = malloc(SERVER_MAX_INPUT + 1);
+	memset(unended, 'x', SERVER_MAX_INPUT);
+	unended[SERVER_MAX_INPUT] = '\0';
+	assert(server_gives((char *[]) { unended }, (char *[]) { "" }, 1));
+	free(unended);
+
+	struct cache cache = cache_create();
+	struct parser_result first = cache_parse(&cache, " print x uit;", 13, NULL);
+	assert(!first.error);
+	assert(cache_parse(&cache, "print x uit; ", 12, NULL).ast == first.ast);
+	assert(cache_parse(&cache, "print y uit;", 12, NULL).ast != first.ast);
+	struct parser_result bad = cache_parse(&cache, "print x;", 8, NULL);
+	assert(bad.error);
+	struct budget shallow = { .depth = 2 };
+	bad = cache_parse(&cache, "print (((1))) uit;", 18, &shallow);
+	assert(bad.error && bad.error->code == diagnostic_too_deep);
+	/* A full cache keeps what it returned until it is trimmed between lines. */
+	for (int n = 0; n <= 1 << 16; n++) {
+		char stmt[32];
+		int len = snprintf(stmt, sizeof(stmt), "print %d uit;", n);
+		assert(!cache_parse(&cache, stmt, len, NULL).error);
+	}
+	assert(first.ast->children.nelts == 1 && cache.nentries > 1 << 16);
+	cache_trim(&cache);
+	assert(cache.nentries == 0);
+	cache_destroy(&cache);
+	assert(cache_points("print 1 uit;   print (1 uit;"));
+	assert(cache_points("print 1 uit;\n  laat x 2 zijn; print x + y uit;"));
+	assert(cache_points("  herhaal 2 keer print 1 uit;\n klaar; print @ uit;"));
+
+	char *out = interpret("print 9007199254740993 uit; print 7 / 2 uit;");
+	assert(strcmp(out, "9007199254740993.000000\n3.500000\n") == 0);
+	free(out);
+	out = interpret("laat x 9223372036854775807 zijn; print x + 1 - 1 uit; "
+			"print 99999999999999999999 uit;");
+	assert(strcmp(out, "9223372036854775808.000000\n100000000000000000000.000000\n") == 0);
+	free(out);
+	out = interpret("laat x 1 zijn; herhaal 3 keer laat x x * 2 zijn; print het uit; klaar; "
+			"herhaal 4 / 2 keer print x uit; klaar; herhaal 0 - 1 keer klaar;");
+	assert(strcmp(out, "2.000000\n4.000000\n8.000000\n8.000000\n8.000000\n"
+		      "can't repeat -1.000000 times\n") == 0);
+	free(out);
+
+	assert(compiler_matches(""));
+	assert(compiler_matches("print 2 + 2 uit;"));
+	assert(compiler_matches("laat x 1 zijn; laat y x / 3 zijn; print x - y * 7 uit;"));
+	assert(compiler_matches("laat x 1 zijn; laat het het * 5 zijn; print het uit;"));
+	assert(compiler_matches("laat x 1 zijn; laat x x + 1 zijn; print x / 0 uit;"));
+	assert(compiler_matches("laat x 3037000500 zijn; print x * x uit; print x * 3037000499 uit;"));
+	assert(compiler_matches("print 99999999999999999999 - 9007199254740993 uit;"));
+	assert(compiler_matches("print 1 uit; print y uit; print 2 uit;"));
+	assert(compiler_matches("laat het 1 zijn;"));
+	assert(compiler_matches("laat n 3 zijn; herhaal n keer laat n n - 1 zijn; print n uit; klaar; "
+				"herhaal 2 keer herhaal n + 1 keer print 7 uit; klaar; klaar;"));
+	assert(compiler_matches("laat a 1 zijn; herhaal a keer laat b a zijn; klaar; print het uit; "
+				"herhaal 0 keer laat c 1 zijn; klaar; laat het het + 1 zijn; print c uit;"));
+	assert(compiler_matches("herhaal 2 keer print 1 uit; print het uit; klaar;"));
+	assert(compiler_matches("herhaal 3 keer laat het 1 zijn; klaar;"));
+	assert(compiler_matches("herhaal 0 keer laat het 1 zijn; klaar; print 2 uit;"));
+	assert(compiler_matches("laat x 1 zijn; herhaal 3 keer laat het het + 1 zijn; klaar; "
+				"herhaal x keer laat y 2 zijn; klaar; print het uit;"));
+	assert(compiler_matches("laat x 2 zijn; herhaal x / 3 keer klaar;"));
 
 	struct array_int a = array_create_int();
 	assert(array_push_int(&a) == a.elts);
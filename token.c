@@ -3,8 +3,6 @@
 #include "token.h"
 #include <assert.h>
 #include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
 
 struct token token_create(enum token_type type)
 {
@@ -13,15 +11,16 @@ struct token token_create(enum token_type type)
 	};
 }
 
-struct token token_create_name(char *name)
+struct token token_create_name(char const *name, int length)
 {
 	return (struct token) {
 		.type = token_name,
-		.name_value = name
+		.name_value = name,
+		.name_length = length
 	};
 }
 
-struct token token_create_number(double number)
+struct token token_create_number(struct value number)
 {
 	return (struct token) {
 		.type = token_number,
@@ -29,7 +28,7 @@ struct token token_create_number(double number)
 	};
 }
 
-struct token token_create_error(char *error)
+struct token token_create_error(enum token_error error)
 {
 	return (struct token) {
 		.error = error,
@@ -37,27 +36,6 @@ struct token token_create_error(char *error)
 	};
 }
 
-void token_destroy(struct token *token)
-{
-	if (token->type == token_name)
-		free(token->name_value);
-	free(token->error);
-}
-
-char *token_to_string(struct token token)
-{
-	char *s;
-
-	if (token.type == token_name)
-		asprintf(&s, "<\"%s\">", token.name_value);
-	else if (token.type == token_number)
-		asprintf(&s, "<%.5f>", token.number_value);
-	else
-		asprintf(&s, "<%s>", token_type_to_string(token.type));
-
-	return s;
-}
-
 char const *token_type_to_string(enum token_type type)
 {
 	switch (type) {
@@ -76,6 +54,9 @@ char const *token_type_to_string(enum token_type type)
 	case token_print: return "print";
 	case token_uit: return "uit";
 	case token_en: return "en";
+	case token_herhaal: return "herhaal";
+	case token_keer: return "keer";
+	case token_klaar: return "klaar";
 	case token_end: return "end";
 	case token_none: return "none";
 	default: assert(false);
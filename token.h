@@ -1,5 +1,9 @@
 #pragma once
 
+#include "value.h"
+
+#define MAX_NAME_LENGTH 100
+
 enum token_type {
 	token_plus,
 	token_minus,
@@ -18,25 +22,47 @@ enum token_type {
 	token_print,
 	token_uit,
 	token_en,
+	token_herhaal,
+	token_keer,
+	token_klaar,
 
 	token_end,
 
 	token_none
 };
 
+enum token_error {
+	token_error_invalid_character = 1,
+	token_error_name_too_long
+};
+
+/* Where a token or node starts in the input; lines and columns count from 1. */
+struct span {
+	int offset;
+	int length;
+	int line;
+	int column;
+};
+
+/*
+ * Tokens own no memory: names point into the lexer input, and a token of type
+ * token_none says which lexical error starts at its offset.
+ */
 struct token {
 	enum token_type type;
+	struct span span;
 	union {
-		double number_value;
-		char *name_value;
+		struct value number_value;
+		struct {
+			char const *name_value;
+			int name_length;
+		};
+		enum token_error error;
 	};
-	char *error;
 };
 
 struct token token_create(enum token_type type);
-struct token token_create_name(char *name);
-struct token token_create_number(double number);
-struct token token_create_error(char *error);
-void token_destroy(struct token *token);
-char *token_to_string(struct token token);
+struct token token_create_name(char const *name, int length);
+struct token token_create_number(struct value number);
+struct token token_create_error(enum token_error error);
 const char *token_type_to_string(enum token_type token);
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A number. Integers stay exact in 64 bits through addition, subtraction and
+ * multiplication; a division, or a result that would overflow, gives a real.
+ */
+enum value_type {
+	value_integer,
+	value_real
+};
+
+struct value {
+	enum value_type type;
+	union {
+		int64_t integer;
+		double real;
+	};
+};
+
+static inline struct value value_create_integer(int64_t integer)
+{
+	return (struct value) { .type = value_integer, .integer = integer };
+}
+
+static inline struct value value_create_real(double real)
+{
+	return (struct value) { .type = value_real, .real = real };
+}
+
+static inline double value_to_double(struct value v)
+{
+	return v.type == value_integer ? (double)v.integer : v.real;
+}
+
+static inline bool value_equal(struct value a, struct value b)
+{
+	if (a.type != b.type)
+		return false;
+
+	return a.type == value_integer ? a.integer == b.integer : a.real == b.real;
+}
+
+static inline struct value value_add(struct value a, struct value b)
+{
+	int64_t n;
+	if (a.type == value_integer && b.type == value_integer &&
+	    !__builtin_add_overflow(a.integer, b.integer, &n))
+		return value_create_integer(n);
+
+	return value_create_real(value_to_double(a) + value_to_double(b));
+}
+
+static inline struct value value_subtract(struct value a, struct value b)
+{
+	int64_t n;
+	if (a.type == value_integer && b.type == value_integer &&
+	    !__builtin_sub_overflow(a.integer, b.integer, &n))
+		return value_create_integer(n);
+
+	return value_create_real(value_to_double(a) - value_to_double(b));
+}
+
+static inline struct value value_multiply(struct value a, struct value b)
+{
+	int64_t n;
+	if (a.type == value_integer && b.type == value_integer &&
+	    !__builtin_mul_overflow(a.integer, b.integer, &n))
+		return value_create_integer(n);
+
+	return value_create_real(value_to_double(a) * value_to_double(b));
+}
+
+static inline struct value value_divide(struct value a, struct value b)
+{
+	return value_create_real(value_to_double(a) / value_to_double(b));
+}
+
+/* How often "herhaal v keer" repeats, or -1 unless v is a whole number of at least 0. */
+static inline int64_t value_count(struct value v)
+{
+	if (v.type == value_integer)
+		return v.integer < 0 ? -1 : v.integer;
+	if (v.real >= 0 && v.real < 0x1p63 && v.real == (double)(int64_t)v.real)
+		return v.real;
+	return -1;
+}
+
+/* Prints like "%f\n" would, but integers are printed exactly. */
+static inline void value_print(struct value v, FILE *f)
+{
+	if (v.type == value_integer)
+		fprintf(f, "%" PRId64 ".000000\n", v.integer);
+	else
+		fprintf(f, "%f\n", v.real);
+}